@@ -21,9 +21,14 @@ loaded into the data segment
     #include <sys/uio.h>
     #include <unistd.h>
 #endif
+#include <sys/stat.h>
 #include "wl_def.h"
 #include <retro_endian.h>
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 #define THREEBYTEGRSTARTS
 
 /*
@@ -39,6 +44,16 @@ typedef struct
     word bit0,bit1;       /* 0-255 is a character, > is a pointer to a node */
 } huffnode;
 
+/* the codes of a huffman dictionary by their first HUFFTABLEBITS bits */
+#define HUFFTABLEBITS   10
+#define HUFFTABLESIZE   (1 << HUFFTABLEBITS)
+
+typedef struct
+{
+    word value;           /* the character, or node + 256 to go on from */
+    byte bits;            /* bits taken by the lookup */
+} huffcode;
+
 
 typedef struct
 {
@@ -98,6 +113,7 @@ huffnode *grhuffman;
 #else
 huffnode grhuffman[255];
 #endif
+static huffcode grhuffcodes[HUFFTABLESIZE];
 
 int    grhandle = -1;               /* handle to EGAGRAPH */
 int    maphandle = -1;              /* handle to MAPTEMP / GAMEMAPS */
@@ -208,25 +224,69 @@ boolean CA_LoadFile (const char *filename, memptr *ptr)
 ============================================================================
 */
 
-static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *hufftable)
+/*
+======================
+=
+= CAL_FillHuffCodes
+=
+= Fills the entries of codes that start with the code bits long leading
+= to nodeval.  Codes longer than the table stop at the node they reach.
+=
+======================
+*/
+
+static void CAL_FillHuffCodes(huffnode *hufftable, huffcode *codes, word nodeval, int code, int bits)
 {
-    byte *end;
-    huffnode *headptr, *huffptr;
+    int i;
+    huffnode *huffptr;
 
-    if(!length || !dest)
+    if(nodeval < 256 || bits == HUFFTABLEBITS)
     {
-        Quit("length or dest is null!");
+        for(i = code; i < HUFFTABLESIZE; i += 1 << bits)
+        {
+            codes[i].value = nodeval;
+            codes[i].bits  = (byte) bits;
+        }
         return;
     }
 
-    headptr = hufftable+254;        /* head node is always node 254 */
+    huffptr = hufftable + (nodeval - 256);
+    CAL_FillHuffCodes(hufftable, codes, huffptr->bit0, code, bits + 1);
+    CAL_FillHuffCodes(hufftable, codes, huffptr->bit1, code | (1 << bits), bits + 1);
+}
 
-    int written = 0;
+/*
+======================
+=
+= CAL_BuildHuffCodes
+=
+======================
+*/
 
-    end=dest+length;
+static void CAL_BuildHuffCodes(huffnode *hufftable, huffcode *codes)
+{
+    /* head node is always node 254 */
+    CAL_FillHuffCodes(hufftable, codes, 254 + 256, 0, 0);
+}
+
+/*
+======================
+=
+= CAL_HuffExpandBits
+=
+= Walks the tree a bit at a time from bit mask of source until dest
+= reaches end
+=
+======================
+*/
+
+static void CAL_HuffExpandBits(byte *source, byte mask, byte *dest, byte *end, huffnode *hufftable)
+{
+    huffnode *headptr, *huffptr;
+
+    headptr = hufftable+254;        /* head node is always node 254 */
 
     byte val = *source++;
-    byte mask = 1;
     word nodeval;
     huffptr = headptr;
     while(1)
@@ -245,7 +305,6 @@ static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *h
         if(nodeval<256)
         {
             *dest++ = (byte) nodeval;
-            written++;
             huffptr = headptr;
             if(dest>=end) break;
         }
@@ -256,6 +315,77 @@ static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *h
     }
 }
 
+/*
+======================
+=
+= CAL_HuffExpand
+=
+= Looks up HUFFTABLEBITS bits at a time in codes.  Every code is at least
+= a bit long, so while HUFFTAILBYTES or more bytes are left to write the
+= stream still holds every bit the lookups peek at.  The rest is walked
+= a bit at a time, which reads no further than it always did.
+=
+======================
+*/
+
+#define HUFFTAILBYTES   40
+
+static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *hufftable, huffcode *codes)
+{
+    byte *end;
+    huffnode *huffptr;
+    huffcode *code;
+    uint32_t bitbuf = 0;
+    int bitcount = 0;
+    word nodeval;
+
+    if(!length || !dest)
+    {
+        Quit("length or dest is null!");
+        return;
+    }
+
+    end=dest+length;
+
+    while(end - dest >= HUFFTAILBYTES)
+    {
+        while(bitcount <= 24)
+        {
+            bitbuf   |= (uint32_t) *source++ << bitcount;
+            bitcount += 8;
+        }
+
+        code      = &codes[bitbuf & (HUFFTABLESIZE - 1)];
+        nodeval   = code->value;
+        bitbuf  >>= code->bits;
+        bitcount -= code->bits;
+
+        /* longer than the table, go on down the tree */
+        while(nodeval >= 256)
+        {
+            if(!bitcount)
+            {
+                bitbuf   = *source++;
+                bitcount = 8;
+            }
+
+            huffptr = hufftable + (nodeval - 256);
+            nodeval = (bitbuf & 1) ? huffptr->bit1 : huffptr->bit0;
+            bitbuf >>= 1;
+            bitcount--;
+        }
+
+        *dest++ = (byte) nodeval;
+    }
+
+    if(dest < end)
+    {
+        /* back up to the first bit not taken yet */
+        source -= (bitcount + 7) >> 3;
+        CAL_HuffExpandBits(source, (byte) (1 << ((8 - (bitcount & 7)) & 7)), dest, end, hufftable);
+    }
+}
+
 /*
 ======================
 =
@@ -442,6 +572,8 @@ void CAL_SetupGrFile (void)
    int handle;
    int j;
    byte *compseg;
+   byte *cached, *asset;
+   int32_t cachedsize;
    const byte* d = NULL;
    int32_t* i    = NULL;
 
@@ -507,6 +639,8 @@ void CAL_SetupGrFile (void)
    }
 #endif
 
+   CAL_BuildHuffCodes(grhuffman, grhuffcodes);
+
    /* Open the graphics file, leaving it open until the game is finished */
    strcpy(fname,gfilename);
    strcat(fname,graphext);
@@ -518,11 +652,19 @@ void CAL_SetupGrFile (void)
    /* load the pic and sprite headers into the arrays in the data segment */
    pictable=(pictabletype *) malloc(NUMPICS*sizeof(pictabletype));
    CHECKMALLOCRESULT(pictable);
+
+   cached = CA_GetAsset(ASSET_PICTABLE, 0, &cachedsize);
+   if (cached && cachedsize == NUMPICS*sizeof(pictabletype))
+   {
+      memcpy(pictable, cached, cachedsize);
+      return;
+   }
+
    CAL_GetGrChunkLength(STRUCTPIC);                /* position file pointer */
    compseg=(byte *) malloc(chunkcomplen);
    CHECKMALLOCRESULT(compseg);
    read (grhandle,compseg,chunkcomplen);
-   CAL_HuffExpand(compseg, (byte*)pictable, NUMPICS * sizeof(pictabletype), grhuffman);
+   CAL_HuffExpand(compseg, (byte*)pictable, NUMPICS * sizeof(pictabletype), grhuffman, grhuffcodes);
    free(compseg);
 
 	for (j = 0; j < NUMPICS; j++)
@@ -530,6 +672,10 @@ void CAL_SetupGrFile (void)
 		pictable[j].height = (word)Retro_SwapLES16(pictable[j].height);
 		pictable[j].width  = (word)Retro_SwapLES16(pictable[j].width);
 	}
+   asset = (byte *) malloc(NUMPICS*sizeof(pictabletype));
+   CHECKMALLOCRESULT(asset);
+   memcpy(asset, pictable, NUMPICS*sizeof(pictabletype));
+   CA_AddAsset(ASSET_PICTABLE, 0, asset, NUMPICS*sizeof(pictabletype));
 }
 
 //==========================================================================
@@ -659,6 +805,406 @@ void CAL_SetupAudioFile (void)
 //==========================================================================
 
 
+/*
+=============================================================================
+
+                                ASSET CACHE
+
+The results of the slow conversions done at startup -- the decoded pic
+table, the de-planarized latch pics and the resampled digitized sounds --
+are kept in cache.<ext> in the config dir.  The file is keyed by a hash
+of the data files and ASSETCACHEVERSION and is mapped on the next start,
+so the converters only run when it is missing or stale.  Anything that
+had to be converted anyway is added to it by CA_WriteAssetCache.
+
+=============================================================================
+*/
+
+#define ASSETCACHEVERSION   2       /* bump when a cached conversion changes */
+#define ASSETALIGN          16
+
+typedef struct
+{
+    char     magic[4];              /* "WLAC" */
+    uint32_t version;
+    uint64_t key;
+    uint32_t numassets;
+    uint32_t filesize;
+} assetcacheheader;
+
+typedef struct
+{
+    word     type, index;
+    uint32_t offset;                /* from the start of the file */
+    uint32_t size;
+} assetentry;
+
+boolean assetcachewarm;
+
+static byte       *assetcache;      /* the whole cache file */
+static size_t      assetcachesize;
+static boolean     assetcachemapped;
+static assetentry *assetentries;    /* points into assetcache */
+static int         numassetentries;
+static uint64_t    assetcachekey;
+static char        assetcachepath[300];
+
+/* assets converted during this start, added to the file by CA_WriteAssetCache */
+static assetentry *newassets;
+static byte      **newassetdata;
+static int         numnewassets, maxnewassets;
+static int         numwrittenassets;
+static LR_Mutex   *newassetmutex;   /* the startup tasks convert concurrently */
+
+/*
+======================
+=
+= CAL_HashFile
+=
+= Folds the contents of a file into a 64 bit FNV-1a hash, eight bytes at
+= a time
+=
+======================
+*/
+
+static uint64_t CAL_HashFile (const char *fname, uint64_t hash)
+{
+    int       handle, i;
+    int32_t   len;
+    uint64_t  word64;
+
+    handle = open(fname, O_RDONLY | O_BINARY);
+    if (handle == -1)
+        return hash;                /* the loader will complain about it */
+
+    while ((len = read(handle, bufferseg, sizeof(bufferseg))) > 0)
+    {
+        for (i = 0; i + 8 <= len; i += 8)
+        {
+            memcpy(&word64, (byte *) bufferseg + i, 8);
+            hash = (hash ^ word64) * 0x100000001b3ULL;
+        }
+        for (; i < len; i++)
+            hash = (hash ^ ((byte *) bufferseg)[i]) * 0x100000001b3ULL;
+    }
+    close(handle);
+
+    return hash;
+}
+
+/*
+======================
+=
+= CAL_CloseAssetCache
+=
+======================
+*/
+
+static void CAL_CloseAssetCache (void)
+{
+    int i;
+
+#ifdef HAVE_MMAP
+    if (assetcachemapped)
+        munmap(assetcache, assetcachesize);
+    else
+#endif
+        free(assetcache);
+
+    assetcache       = NULL;
+    assetcachesize   = 0;
+    assetcachemapped = false;
+    assetentries     = NULL;
+    numassetentries  = 0;
+    assetcachewarm   = false;
+
+    for (i = 0; i < numnewassets; i++)
+        free(newassetdata[i]);
+    free(newassets);
+    free(newassetdata);
+    newassets    = NULL;
+    newassetdata = NULL;
+    numnewassets = maxnewassets = numwrittenassets = 0;
+}
+
+/*
+======================
+=
+= CAL_OpenAssetCache
+=
+= Maps the asset cache if it belongs to the current data files
+=
+======================
+*/
+
+static void CAL_OpenAssetCache (void)
+{
+    static const char *const datanames[] = {"vswap.", gheadname, gfilename, gdictname};
+    char      fname[13];
+    int       handle, i;
+    uint64_t  key = 0xcbf29ce484222325ULL;
+    struct stat st;
+    assetcacheheader *header;
+
+    for (i = 0; i < (int) lengthof(datanames); i++)
+    {
+        strcpy(fname, datanames[i]);
+        strcat(fname, i ? graphext : extension);
+        key = CAL_HashFile(fname, key);
+    }
+    assetcachekey = key ^ ASSETCACHEVERSION;
+
+    if (!newassetmutex)
+        newassetmutex = LR_CreateMutex();
+
+    if (configdir[0])
+        snprintf(assetcachepath, sizeof(assetcachepath), "%s/cache.%s", configdir, extension);
+    else
+        snprintf(assetcachepath, sizeof(assetcachepath), "cache.%s", extension);
+
+    handle = open(assetcachepath, O_RDONLY | O_BINARY);
+    if (handle == -1)
+        return;
+
+    if (fstat(handle, &st) || st.st_size < (off_t) sizeof(assetcacheheader))
+    {
+        close(handle);
+        return;
+    }
+    assetcachesize = st.st_size;
+
+#ifdef HAVE_MMAP
+    if (!param_nommap)
+    {
+        assetcache = (byte *) mmap(NULL, assetcachesize, PROT_READ, MAP_PRIVATE, handle, 0);
+        if (assetcache == (byte *) MAP_FAILED)
+            assetcache = NULL;
+        else
+            assetcachemapped = true;
+    }
+#endif
+    if (!assetcache)
+    {
+        assetcache = (byte *) malloc(assetcachesize);
+        CHECKMALLOCRESULT(assetcache);
+        if (read(handle, assetcache, assetcachesize) != (int32_t) assetcachesize)
+            assetcachesize = 0;     /* fails the checks below */
+    }
+    close(handle);
+
+    header = (assetcacheheader *) assetcache;
+    if (assetcachesize < sizeof(*header)
+        || memcmp(header->magic, "WLAC", 4)
+        || header->version != ASSETCACHEVERSION
+        || header->key != assetcachekey
+        || header->filesize != assetcachesize
+        || header->numassets > (assetcachesize - sizeof(*header)) / sizeof(assetentry))
+    {
+        CAL_CloseAssetCache();      /* stale, rebuilt from scratch */
+        return;
+    }
+
+    assetentries    = (assetentry *) (header + 1);
+    numassetentries = header->numassets;
+
+    for (i = 0; i < numassetentries; i++)
+    {
+        if (assetentries[i].offset > assetcachesize
+            || assetentries[i].size > assetcachesize - assetentries[i].offset)
+        {
+            CAL_CloseAssetCache();
+            return;
+        }
+    }
+
+    assetcachewarm = true;
+}
+
+/*
+======================
+=
+= CA_GetAsset
+=
+= Returns a converted asset from the asset cache and its size, or NULL
+= if it has to be converted
+=
+======================
+*/
+
+byte *CA_GetAsset (int type, int index, int32_t *size)
+{
+    int i;
+
+    for (i = 0; i < numassetentries; i++)
+    {
+        if (assetentries[i].type == type && assetentries[i].index == index)
+        {
+            *size = assetentries[i].size;
+            return assetcache + assetentries[i].offset;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+======================
+=
+= CA_AddAsset
+=
+= Takes over a freshly converted asset in a malloced buffer, which
+= CA_WriteAssetCache adds to the cache.  The buffer must be filled in
+= already, as the sound prefetch thread may write the cache at any time.
+=
+======================
+*/
+
+void CA_AddAsset (int type, int index, byte *data, int32_t size)
+{
+    if (newassetmutex)
+        LR_LockMutex(newassetmutex);
+
+    if (numnewassets == maxnewassets)
+    {
+        maxnewassets = maxnewassets ? maxnewassets * 2 : 64;
+        newassets = (assetentry *) realloc(newassets, maxnewassets * sizeof(*newassets));
+        CHECKMALLOCRESULT(newassets);
+        newassetdata = (byte **) realloc(newassetdata, maxnewassets * sizeof(*newassetdata));
+        CHECKMALLOCRESULT(newassetdata);
+    }
+
+    newassets[numnewassets].type  = type;
+    newassets[numnewassets].index = index;
+    newassets[numnewassets].size  = size;
+    newassetdata[numnewassets++]  = data;
+
+    if (newassetmutex)
+        LR_UnlockMutex(newassetmutex);
+}
+
+/*
+======================
+=
+= CAL_WriteAssetCache
+=
+= Writes the cached and the new assets to a fresh cache file
+=
+======================
+*/
+
+static boolean CAL_WriteAssetCache (void)
+{
+    static const byte padding[ASSETALIGN];
+    FILE     *file;
+    char      tmppath[sizeof(assetcachepath) + 4];
+    int       i, j, total;
+    uint32_t  offset;
+    assetcacheheader header;
+    assetentry *entry;
+    byte    **source;
+
+    entry = (assetentry *) malloc((numassetentries + numnewassets) * sizeof(*entry));
+    CHECKMALLOCRESULT(entry);
+    source = (byte **) malloc((numassetentries + numnewassets) * sizeof(*source));
+    CHECKMALLOCRESULT(source);
+
+    /* keep the cached assets that were not converted again */
+    total = 0;
+    for (i = 0; i < numassetentries; i++)
+    {
+        for (j = 0; j < numnewassets; j++)
+        {
+            if (newassets[j].type == assetentries[i].type
+                && newassets[j].index == assetentries[i].index)
+                break;
+        }
+        if (j == numnewassets)
+        {
+            entry[total]    = assetentries[i];
+            source[total++] = assetcache + assetentries[i].offset;
+        }
+    }
+    for (i = 0; i < numnewassets; i++)
+    {
+        entry[total]    = newassets[i];
+        source[total++] = newassetdata[i];
+    }
+
+    offset = (sizeof(header) + total * sizeof(*entry) + ASSETALIGN - 1) & ~(ASSETALIGN - 1);
+    for (i = 0; i < total; i++)
+    {
+        entry[i].offset = offset;
+        offset += (entry[i].size + ASSETALIGN - 1) & ~(ASSETALIGN - 1);
+    }
+
+    memcpy(header.magic, "WLAC", 4);
+    header.version   = ASSETCACHEVERSION;
+    header.key       = assetcachekey;
+    header.numassets = total;
+    header.filesize  = offset;
+
+    /* write next to the old file and swap it in, so a mapped cache stays intact */
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", assetcachepath);
+    file = fopen(tmppath, "wb");
+    if (!file)
+    {
+        free(entry);
+        free(source);
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(entry, sizeof(*entry), total, file);
+    offset = sizeof(header) + total * sizeof(*entry);
+
+    for (i = 0; i < total; i++)
+    {
+        fwrite(padding, 1, entry[i].offset - offset, file);
+        fwrite(source[i], 1, entry[i].size, file);
+        offset = entry[i].offset + entry[i].size;
+    }
+    fwrite(padding, 1, header.filesize - offset, file);
+    free(entry);
+    free(source);
+
+    i = ferror(file);
+    if (fclose(file) || i)
+    {
+        remove(tmppath);
+        return false;
+    }
+#ifdef _WIN32
+    remove(assetcachepath);
+#endif
+    return rename(tmppath, assetcachepath) == 0;
+}
+
+/*
+======================
+=
+= CA_WriteAssetCache
+=
+= Rewrites the cache file if any asset had to be converted since it was
+= last written.  The new assets are kept until CA_Shutdown, as the sounds
+= converted later on go into the same file.
+=
+======================
+*/
+
+void CA_WriteAssetCache (void)
+{
+    if (newassetmutex)
+        LR_LockMutex(newassetmutex);
+
+    if (numnewassets != numwrittenassets && CAL_WriteAssetCache())
+        numwrittenassets = numnewassets;
+
+    if (newassetmutex)
+        LR_UnlockMutex(newassetmutex);
+}
+
+//==========================================================================
+
 /*
 ======================
 =
@@ -676,6 +1222,7 @@ void CA_Startup (void)
     profilehandle = open("PROFILE.TXT", O_CREAT | O_WRONLY | O_TEXT);
 #endif
 
+    CAL_OpenAssetCache ();
     CAL_SetupMapFile ();
     CAL_SetupGrFile ();
     CAL_SetupAudioFile ();
@@ -710,6 +1257,10 @@ void CA_Shutdown (void)
     for(i=0; i<NUMCHUNKS; i++)
         UNCACHEGRCHUNK(i);
     free(pictable);
+    CA_WriteAssetCache ();          /* sounds converted on demand */
+    CAL_CloseAssetCache ();
+    LR_DestroyMutex (newassetmutex);
+    newassetmutex = NULL;
 
     switch(oldsoundmode)
     {
@@ -906,7 +1457,7 @@ void CAL_ExpandGrChunk (int chunk, int32_t *source)
      * Sprites need to have shifts made and various other junk. */
     grsegs[chunk]=(byte *) malloc(expanded);
     CHECKMALLOCRESULT(grsegs[chunk]);
-    CAL_HuffExpand((byte *) source, grsegs[chunk], expanded, grhuffman);
+    CAL_HuffExpand((byte *) source, grsegs[chunk], expanded, grhuffman, grhuffcodes);
 }
 
 
@@ -971,6 +1522,93 @@ void CA_CacheGrChunk (int chunk)
 
 //==========================================================================
 
+/*
+======================
+=
+= CA_HuffBench
+=
+= Expands the graphics chunks with explicit lengths passes times with
+= the bit walker and with the table, checks both give the same bytes and
+= prints the throughput of each, for --huffbench
+=
+======================
+*/
+
+void CA_HuffBench (int passes)
+{
+    int       chunk, next, pass, numchunks = 0;
+    int32_t   pos, compressed, total = 0, maxexpanded = 0;
+    int32_t   expanded[NUMCHUNKS];
+    byte     *source[NUMCHUNKS], *dest[2];
+    uint64_t  start, time[2];
+
+    for(chunk = STRUCTPIC + 1; chunk < NUMCHUNKS; chunk++)
+    {
+        source[chunk] = NULL;
+
+        /* sparse, or a tile with an implicit length */
+        pos = GRFILEPOS(chunk);
+        if(pos < 0 || (chunk >= STARTTILE8 && chunk < STARTEXTERNS))
+            continue;
+
+        next = chunk + 1;
+        while(GRFILEPOS(next) == -1)
+            next++;
+        compressed = GRFILEPOS(next) - pos;
+
+        source[chunk] = (byte *) malloc(compressed);
+        CHECKMALLOCRESULT(source[chunk]);
+        lseek(grhandle, pos, SEEK_SET);
+        read(grhandle, source[chunk], compressed);
+
+        expanded[chunk] = Retro_SwapLES32(*(int32_t *) (void *) source[chunk]);
+        if(expanded[chunk] > maxexpanded)
+            maxexpanded = expanded[chunk];
+        total += expanded[chunk];
+        numchunks++;
+    }
+
+    dest[0] = (byte *) malloc(maxexpanded);
+    dest[1] = (byte *) malloc(maxexpanded);
+    CHECKMALLOCRESULT(dest[0]);
+    CHECKMALLOCRESULT(dest[1]);
+
+    for(chunk = STRUCTPIC + 1; chunk < NUMCHUNKS; chunk++)
+    {
+        if(!source[chunk] || !expanded[chunk])
+            continue;
+
+        CAL_HuffExpandBits(source[chunk] + 4, 1, dest[0], dest[0] + expanded[chunk], grhuffman);
+        CAL_HuffExpand(source[chunk] + 4, dest[1], expanded[chunk], grhuffman, grhuffcodes);
+        if(memcmp(dest[0], dest[1], expanded[chunk]))
+            printf("huffbench: chunk %d differs!\n", chunk);
+    }
+
+    start = LR_GetPerformanceCounter();
+    for(pass = 0; pass < passes; pass++)
+        for(chunk = STRUCTPIC + 1; chunk < NUMCHUNKS; chunk++)
+            if(source[chunk] && expanded[chunk])
+                CAL_HuffExpandBits(source[chunk] + 4, 1, dest[0], dest[0] + expanded[chunk], grhuffman);
+    time[0] = LR_GetPerformanceCounter() - start;
+
+    start = LR_GetPerformanceCounter();
+    for(pass = 0; pass < passes; pass++)
+        for(chunk = STRUCTPIC + 1; chunk < NUMCHUNKS; chunk++)
+            if(source[chunk] && expanded[chunk])
+                CAL_HuffExpand(source[chunk] + 4, dest[1], expanded[chunk], grhuffman, grhuffcodes);
+    time[1] = LR_GetPerformanceCounter() - start;
+
+    printf("huffbench: %d chunks, %d bytes, %d passes: bit walker %.1f MB/s, table %.1f MB/s\n",
+            numchunks, total, passes,
+            (double) total * passes / (time[0] ? time[0] : 1),
+            (double) total * passes / (time[1] ? time[1] : 1));
+
+    for(chunk = STRUCTPIC + 1; chunk < NUMCHUNKS; chunk++)
+        free(source[chunk]);
+    free(dest[0]);
+    free(dest[1]);
+}
+
 /*
 ======================
 =
@@ -1014,7 +1652,7 @@ void CA_CacheScreen (int chunk)
     * Sprites need to have shifts made and various other junk. */
    byte *pic = (byte *) malloc(64000);
    CHECKMALLOCRESULT(pic);
-   CAL_HuffExpand((byte *) source, pic, expanded, grhuffman);
+   CAL_HuffExpand((byte *) source, pic, expanded, grhuffman, grhuffcodes);
 
    vbuf = VL_LockSurface(curSurface);
    for(y = 0, scy = 0; y < 200; y++, scy += scaleFactor)
@@ -1028,6 +1666,7 @@ void CA_CacheScreen (int chunk)
       }
    }
    VL_UnlockSurface(curSurface);
+   VL_MarkDirty(0, 0, 320 * scaleFactor, 200 * scaleFactor);
    free(pic);
    free(bigbufferseg);
 }
@@ -31,6 +31,16 @@ extern  char  extension[5];
 extern  char  graphext[5];
 extern  char  audioext[5];
 
+/* the kinds of converted assets kept in the asset cache */
+enum
+{
+    ASSET_PICTABLE,
+    ASSET_LATCHPIC,                 /* by latchpics index, packed rows */
+    ASSET_SOUND                     /* by digi sound, as the mixer converted it */
+};
+
+extern  boolean assetcachewarm;
+
 //===========================================================================
 
 boolean CA_LoadFile (const char *filename, memptr *ptr);
@@ -50,6 +60,11 @@ void CA_CacheGrChunk (int chunk);
 void CA_CacheMap (int mapnum);
 
 void CA_CacheScreen (int chunk);
+void CA_HuffBench (int passes);
+
+byte *CA_GetAsset (int type, int index, int32_t *size);
+void CA_AddAsset (int type, int index, byte *data, int32_t size);
+void CA_WriteAssetCache (void);
 
 void CA_CannotOpen(const char *name);
 
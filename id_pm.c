@@ -1,6 +1,10 @@
 #include "wl_def.h"
 #include <retro_endian.h>
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 int ChunksInFile;
 int PMSpriteStart;
 int PMSoundStart;
@@ -16,6 +20,68 @@ size_t PMPageDataSize;
  * The last pointer points one byte after the last page.
  */
 uint8_t **PMPages;
+uint32_t *PMPageSizes;
+
+#ifdef HAVE_MMAP
+/*
+ * Unless --nommap is given VSWAP is mapped and PMPages point right into
+ * the mapping, so the pages are shared with the OS file cache instead
+ * of being read into a second copy.  Sprite pages and the sound info
+ * page must be 2-byte aligned, the ones at odd file offsets are copied
+ * into PMArena.
+ */
+static uint8_t *PMMap;
+static size_t   PMMapSize;
+static uint8_t *PMArena;
+
+static boolean PM_MapPages(FILE *file, long fileSize, uint32_t *pageOffsets)
+{
+   int i;
+   size_t arenaSize = 0;
+   uint8_t *ptr;
+
+   PMMap = (uint8_t *) mmap(NULL, fileSize, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE, fileno(file), 0);
+   if(PMMap == (uint8_t *) MAP_FAILED)
+   {
+      PMMap = NULL;
+      return false;
+   }
+   PMMapSize = fileSize;
+
+   for(i = PMSpriteStart; i < ChunksInFile; i++)
+   {
+      if((i < PMSoundStart || i == ChunksInFile - 1) && (pageOffsets[i] & 1))
+         arenaSize += (PMPageSizes[i] + 1) & ~1;
+   }
+
+   if(arenaSize)
+   {
+      PMArena = (uint8_t *) malloc(arenaSize);
+      CHECKMALLOCRESULT(PMArena);
+   }
+
+   ptr = PMArena;
+   for(i = 0; i < ChunksInFile; i++)
+   {
+      PMPages[i] = PMMap + pageOffsets[i];
+
+      if((i >= PMSpriteStart && i < PMSoundStart) || i == ChunksInFile - 1)
+      {
+         if(pageOffsets[i] & 1)
+         {
+            memcpy(ptr, PMPages[i], PMPageSizes[i]);
+            PMPages[i] = ptr;
+            ptr += (PMPageSizes[i] + 1) & ~1;
+         }
+      }
+   }
+
+   /* last page points after page buffer */
+   PMPages[ChunksInFile] = PMMap + fileSize;
+   return true;
+}
+#endif
 
 void PM_Startup(void)
 {
@@ -103,20 +169,45 @@ void PM_Startup(void)
    if((pageOffsets[ChunksInFile - 1] - dataStart + alignPadding) & 1)
       alignPadding++;
 
+   PMPages = (uint8_t **) malloc((ChunksInFile + 1) * sizeof(uint8_t *));
+   CHECKMALLOCRESULT(PMPages);
+
+   PMPageSizes = (uint32_t *) malloc(ChunksInFile * sizeof(uint32_t));
+   CHECKMALLOCRESULT(PMPageSizes);
+
+   for(i = 0; i < ChunksInFile; i++)
+   {
+      if(!pageOffsets[i])
+         PMPageSizes[i] = 0;  /* sparse page */
+      /* Use specified page length, 
+       * when next page is sparse page.
+       * Otherwise, calculate size from 
+       * the offset difference between this and the next page. */
+      else if(!pageOffsets[i + 1])
+         PMPageSizes[i] = pageLengths[i];
+      else
+         PMPageSizes[i] = pageOffsets[i + 1] - pageOffsets[i];
+   }
+
+#ifdef HAVE_MMAP
+   if(!param_nommap && PM_MapPages(file, fileSize, pageOffsets))
+   {
+      free(pageLengths);
+      free(pageOffsets);
+      fclose(file);
+      return;
+   }
+#endif
+
    PMPageDataSize = (size_t) pageDataSize + alignPadding;
    PMPageData = (uint32_t *) malloc(PMPageDataSize);
    CHECKMALLOCRESULT(PMPageData);
 
-   PMPages = (uint8_t **) malloc((ChunksInFile + 1) * sizeof(uint8_t *));
-   CHECKMALLOCRESULT(PMPages);
-
    /* Load pages and initialize PMPages pointers */
    ptr = (uint8_t *) PMPageData;
 
    for(i = 0; i < ChunksInFile; i++)
    {
-      uint32_t size;
-
       if(((i >= PMSpriteStart) && (i < PMSoundStart)) || (i == ChunksInFile - 1))
       {
          size_t offs = ptr - (uint8_t *) PMPageData;
@@ -135,21 +226,18 @@ void PM_Startup(void)
       if(!pageOffsets[i])
          continue;               // sparse page
 
-      /* Use specified page length, 
-       * when next page is sparse page.
-       * Otherwise, calculate size from 
-       * the offset difference between this and the next page. */
-      if(!pageOffsets[i + 1]) size = pageLengths[i];
-      else size = pageOffsets[i + 1] - pageOffsets[i];
-
       fseek(file, pageOffsets[i], SEEK_SET);
-      fread(ptr, 1, size, file);
-      ptr += size;
+      fread(ptr, 1, PMPageSizes[i], file);
+      ptr += PMPageSizes[i];
    }
 
    /* last page points after page buffer */
    PMPages[ChunksInFile] = ptr;
 
+   /* the sizes include the padding in front of the next page */
+   for(i = 0; i < ChunksInFile; i++)
+      PMPageSizes[i] = (uint32_t) (PMPages[i + 1] - PMPages[i]);
+
    free(pageLengths);
    free(pageOffsets);
    fclose(file);
@@ -157,6 +245,17 @@ void PM_Startup(void)
 
 void PM_Shutdown(void)
 {
+#ifdef HAVE_MMAP
+   if(PMMap)
+      munmap(PMMap, PMMapSize);
+   free(PMArena);
+   PMMap   = NULL;
+   PMArena = NULL;
+#endif
+   free(PMPageSizes);
    free(PMPages);
    free(PMPageData);
+   PMPageSizes = NULL;
+   PMPages     = NULL;
+   PMPageData  = NULL;
 }
@@ -15,6 +15,9 @@ extern bool PMSoundInfoPagePadded;
 // The last pointer points one byte after the last page.
 extern uint8_t **PMPages;
 
+// Page sizes, the pages need not follow each other when VSWAP is mapped
+extern uint32_t *PMPageSizes;
+
 void PM_Startup(void);
 void PM_Shutdown(void);
 
@@ -22,7 +25,7 @@ static inline uint32_t PM_GetPageSize(int page)
 {
     if(page < 0 || page >= ChunksInFile)
         Quit("PM_GetPageSize: Tried to access illegal page: %i", page);
-    return (uint32_t) (PMPages[page + 1] - PMPages[page]);
+    return PMPageSizes[page];
 }
 
 static inline uint8_t *PM_GetPage(int page)
@@ -27,11 +27,19 @@
 //                      NeedsMusic - load music?
 //
 
+/* before wl_def.h, whose #pragma pack(1) would change the layout of Mix_Chunk */
+#include "SDL_mixer/SDL_mixer.h"
 #include "wl_def.h"
 #include <retro_endian.h>
-#include "SDL_mixer/SDL_mixer.h"
 #include "fmopl.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SD_NEON
+#endif
+
 #define ORIGSAMPLERATE 7042
 
 typedef struct
@@ -62,7 +70,16 @@ typedef struct
 } digiinfo;
 
 static Mix_Chunk *SoundChunks[ STARTMUSIC - STARTDIGISOUNDS];
-static byte      *SoundBuffers[STARTMUSIC - STARTDIGISOUNDS];
+
+/* SoundState values, see SD_GetSoundChunk */
+enum { SOUND_UNUSED, SOUND_WANTED, SOUND_LOADING, SOUND_READY };
+
+static volatile byte     SoundState[STARTMUSIC - STARTDIGISOUNDS];
+static LR_Mutex         *soundmutex;
+static LR_Cond          *soundloaded;
+static LR_Thread        *prefetchthread;
+static boolean           prefetchstop;
+static int               mixrate;        /* as negotiated by Mix_OpenAudio */
 
 globalsoundpos channelSoundPos[MIX_CHANNELS];
 
@@ -168,45 +185,236 @@ void SD_SetPosition(int channel, int leftpos, int rightpos)
    }
 }
 
-static Sint16 GetSample(float csample, byte *samples, int size)
+/*
+ * Digitized sounds are resampled from ORIGSAMPLERATE to the mixer rate
+ * with a polyphase windowed sinc filter.  Each output sample is the sum
+ * of the RESAMPLETAPS input samples around it, weighted by the filter
+ * phase nearest to its position between two input samples.  The phases
+ * are built once by SD_SetupResampler in RESAMPLEBITS fixed point, and
+ * SD_Resample computes four output samples at a time with SSE2 or NEON.
+ */
+#define RESAMPLETAPS     8
+#define RESAMPLEPHASEBITS 8
+#define RESAMPLEPHASES   (1 << RESAMPLEPHASEBITS)
+#define RESAMPLEBITS     14
+#define RESAMPLECUTOFF   0.9         /* of the original Nyquist frequency */
+
+static int16_t resamplefilter[RESAMPLEPHASES][RESAMPLETAPS];
+
+static void SD_SetupResampler(void)
 {
-   float val;
-   int32_t intval;
-   float s0=0, s1=0, s2=0;
-   int cursample = (int) csample;
-   float sf = csample - (float) cursample;
+   int p, k, sum, center;
+   double t, x, h, total;
+   double taps[RESAMPLETAPS];
+
+   for(p = 0; p < RESAMPLEPHASES; p++)
+   {
+      total = 0;
+      for(k = 0; k < RESAMPLETAPS; k++)
+      {
+         /* distance of input sample k from the output position */
+         t = k - (RESAMPLETAPS / 2 - 1) - (double) p / RESAMPLEPHASES;
+         x = RESAMPLECUTOFF * M_PI * t;
+         h = x != 0 ? RESAMPLECUTOFF * sin(x) / x : RESAMPLECUTOFF;
+
+         /* Blackman window across all taps */
+         x = 2 * M_PI * (t + RESAMPLETAPS / 2) / RESAMPLETAPS;
+         taps[k] = h * (0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x));
+         total += taps[k];
+      }
+
+      /* unity gain, with the rounding error put into the largest tap */
+      sum = 0;
+      for(k = 0; k < RESAMPLETAPS; k++)
+      {
+         resamplefilter[p][k] = (int16_t) floor(taps[k] / total * (1 << RESAMPLEBITS) + 0.5);
+         sum += resamplefilter[p][k];
+      }
+      center = RESAMPLETAPS / 2 - 1 + (p >= RESAMPLEPHASES / 2);
+      resamplefilter[p][center] += (1 << RESAMPLEBITS) - sum;
+   }
+}
+
+/*
+ * Resamples the 8-bit sound in samples to destsamples 16-bit samples.
+ * padded must hold size + RESAMPLETAPS samples.
+ */
+static void SD_Resample(const byte *samples, int size, Sint16 *dest,
+      int destsamples, int16_t *padded)
+{
+   int i, k;
+   int32_t val;
+   uint64_t pos, step;
+   const int16_t *src, *filter;
+
+   /* signed, with silence around the sound */
+   for(i = 0; i < RESAMPLETAPS / 2 - 1; i++)
+      padded[i] = 0;
+   for(i = 0; i < size; i++)
+      padded[RESAMPLETAPS / 2 - 1 + i] = samples[i] - 128;
+   for(i += RESAMPLETAPS / 2 - 1; i < size + RESAMPLETAPS; i++)
+      padded[i] = 0;
+
+   step = ((uint64_t) size << 32) / destsamples;
+   pos  = 0;
+   i    = 0;
+
+#if defined(__SSE2__)
+   for(; i + 4 <= destsamples; i += 4)
+   {
+      __m128i d[4], lo, hi, sum;
+
+      for(k = 0; k < 4; k++, pos += step)
+      {
+         src    = padded + (pos >> 32);
+         filter = resamplefilter[(pos >> (32 - RESAMPLEPHASEBITS)) & (RESAMPLEPHASES - 1)];
+         d[k]   = _mm_madd_epi16(_mm_loadu_si128((const __m128i *) src),
+               _mm_loadu_si128((const __m128i *) filter));
+      }
 
-   if(cursample-1 >= 0)
-      s0 = (float) (samples[cursample-1] - 128);
+      /* add up the four partial sums of each output sample */
+      lo  = _mm_add_epi32(_mm_unpacklo_epi32(d[0], d[1]), _mm_unpackhi_epi32(d[0], d[1]));
+      hi  = _mm_add_epi32(_mm_unpacklo_epi32(d[2], d[3]), _mm_unpackhi_epi32(d[2], d[3]));
+      sum = _mm_add_epi32(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
 
-   s1 = (float) (samples[cursample] - 128);
+      /* from RESAMPLEBITS fixed point to 16 bits, saturated */
+      sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (RESAMPLEBITS - 9))),
+            RESAMPLEBITS - 8);
+      _mm_storel_epi64((__m128i *) (dest + i), _mm_packs_epi32(sum, sum));
+   }
+#elif defined(SD_NEON)
+   for(; i + 4 <= destsamples; i += 4)
+   {
+      int16x8_t x, f;
+      int32x4_t d[4];
+      int32x2_t lo, hi;
 
-   if(cursample+1 < size)
-      s2 = (float) (samples[cursample+1] - 128);
+      for(k = 0; k < 4; k++, pos += step)
+      {
+         src    = padded + (pos >> 32);
+         filter = resamplefilter[(pos >> (32 - RESAMPLEPHASEBITS)) & (RESAMPLEPHASES - 1)];
+         x      = vld1q_s16(src);
+         f      = vld1q_s16(filter);
+         d[k]   = vmlal_s16(vmull_s16(vget_low_s16(x), vget_low_s16(f)),
+               vget_high_s16(x), vget_high_s16(f));
+      }
 
-   val    = s0*sf*(sf-1)/2 - s1*(sf*sf-1) + s2*(sf+1)*sf/2;
-   intval = (int32_t) (val * 256);
+      lo = vpadd_s32(vadd_s32(vget_low_s32(d[0]), vget_high_s32(d[0])),
+            vadd_s32(vget_low_s32(d[1]), vget_high_s32(d[1])));
+      hi = vpadd_s32(vadd_s32(vget_low_s32(d[2]), vget_high_s32(d[2])),
+            vadd_s32(vget_low_s32(d[3]), vget_high_s32(d[3])));
 
-   if(intval < -32768)
-      intval = -32768;
-   else if(intval > 32767)
-      intval = 32767;
-   return (Sint16) intval;
+      /* rounding, saturating narrow from RESAMPLEBITS fixed point */
+      vst1_s16(dest + i, vqrshrn_n_s32(vcombine_s32(lo, hi), RESAMPLEBITS - 8));
+   }
+#endif
+
+   for(; i < destsamples; i++, pos += step)
+   {
+      src    = padded + (pos >> 32);
+      filter = resamplefilter[(pos >> (32 - RESAMPLEPHASEBITS)) & (RESAMPLEPHASES - 1)];
+
+      val = 0;
+      for(k = 0; k < RESAMPLETAPS; k++)
+         val += src[k] * filter[k];
+      val = (val + (1 << (RESAMPLEBITS - 9))) >> (RESAMPLEBITS - 8);
+
+      if(val < -32768)
+         val = -32768;
+      else if(val > 32767)
+         val = 32767;
+      dest[i] = (Sint16) val;
+   }
 }
 
-void SD_PrepareSound(int which)
+/*
+ * A sound in the asset cache is kept as the mixer converted it, so a
+ * warm start can hand it to the mixer without copying: the mixer spec
+ * it was converted for, followed by a wave file of that format.
+ */
+typedef struct
+{
+   int32_t freq;
+   Uint16  format;
+   Uint16  channels;
+} soundspec;
+
+static boolean SD_LoadCachedSound(int which)
+{
+   int32_t size;
+   int channels = 0;
+   soundspec spec;
+   byte *cached;
+
+   cached = CA_GetAsset(ASSET_SOUND, which, &size);
+   if(cached == NULL || size < (int32_t) (sizeof(spec) + sizeof(headchunk) + sizeof(wavechunk)))
+      return false;
+
+   Mix_QuerySpec(&spec.freq, &spec.format, &channels);
+   spec.channels = channels;
+   if(memcmp(cached, &spec, sizeof(spec)))
+      return false;     /* converted for another output format */
+
+   SoundChunks[which] = Mix_QuickLoad_WAV(cached + sizeof(spec));
+   return SoundChunks[which] != NULL;
+}
+
+static void SD_StoreSound(int which)
+{
+   int bytespersample;
+   int channels = 0;
+   soundspec spec;
+   Mix_Chunk *chunk = SoundChunks[which];
+   byte *asset, *dest;
+   int32_t size;
+
+   if(chunk == NULL)
+      return;
+
+   Mix_QuerySpec(&spec.freq, &spec.format, &channels);
+   spec.channels  = channels;
+   bytespersample = (spec.format & 0xff) / 8 * channels;
+
+   headchunk head = {{'R','I','F','F'}, 0, {'W','A','V','E'},
+      {'f','m','t',' '}, 0x10, 0x0001, 0, 0, 0, 0, 0};
+   head.filelenminus8  = sizeof(head) + chunk->alen;
+   head.channels       = channels;
+   head.samplerate     = spec.freq;
+   head.bytespersec    = spec.freq * bytespersample;
+   head.bytespersample = bytespersample;
+   head.bitspersample  = spec.format & 0xff;
+
+   wavechunk dhead = {{'d', 'a', 't', 'a'}, chunk->alen};
+
+   size = sizeof(spec) + sizeof(head) + sizeof(dhead) + chunk->alen;
+   asset = dest = (byte *) malloc(size);
+   CHECKMALLOCRESULT(dest);
+   memcpy(dest, &spec, sizeof(spec));
+   dest += sizeof(spec);
+   memcpy(dest, &head, sizeof(head));
+   dest += sizeof(head);
+   memcpy(dest, &dhead, sizeof(dhead));
+   dest += sizeof(dhead);
+   memcpy(dest, chunk->abuf, chunk->alen);
+
+   CA_AddAsset(ASSET_SOUND, which, asset, size);
+}
+
+/*
+ * Converts a digitized sound for the mixer, from the asset cache if it
+ * has been converted before
+ */
+static void SD_LoadSound(int which)
 {
-   unsigned i;
    int page, size;
    int destsamples;
+   int wavesize;
    byte *origsamples;
    byte *wavebuffer;
-   Sint16 *newsamples;
-   float samplestep;
-   float cursample = 0.F;
+   int16_t *padded;
 
-   if(DigiList == NULL)
-      Quit("SD_PrepareSound(%i): DigiList not initialized!\n", which);
+   if(SD_LoadCachedSound(which))
+      return;     /* converted on an earlier start */
 
    page = DigiList[which].startpage;
    size = DigiList[which].length;
@@ -215,17 +423,20 @@ void SD_PrepareSound(int which)
    if(origsamples + size >= PM_GetEnd())
       Quit("SD_PrepareSound(%i): Sound reaches out of page file!\n", which);
 
-   destsamples = (int) ((float) size * (float)44100
-         / (float) ORIGSAMPLERATE);
+   destsamples = (int) ((int64_t) size * mixrate / ORIGSAMPLERATE);
+   wavesize    = sizeof(headchunk) + sizeof(wavechunk) + destsamples * 2;
 
-   wavebuffer = (byte *)malloc(sizeof(headchunk) + sizeof(wavechunk)
-         + destsamples * 2);     /* dest are 16-bit samples */
+   wavebuffer = (byte *)malloc(wavesize);     /* dest are 16-bit samples */
    if(wavebuffer == NULL)
       Quit("Unable to allocate wave buffer for sound %i!\n", which);
+   padded = (int16_t *) malloc((size + RESAMPLETAPS) * sizeof(*padded));
+   CHECKMALLOCRESULT(padded);
 
    headchunk head = {{'R','I','F','F'}, 0, {'W','A','V','E'},
-      {'f','m','t',' '}, 0x10, 0x0001, 1, 44100, 44100 * 2, 2, 16};
+      {'f','m','t',' '}, 0x10, 0x0001, 1, 0, 0, 2, 16};
    head.filelenminus8 = sizeof(head) + destsamples*2;  /* (sizeof(dhead)-8 = 0) */
+   head.samplerate    = mixrate;
+   head.bytespersec   = mixrate * 2;
 
    wavechunk dhead = {{'d', 'a', 't', 'a'}, destsamples*2};
 
@@ -234,19 +445,110 @@ void SD_PrepareSound(int which)
 
    /* alignment is correct, as wavebuffer comes from malloc
     * and sizeof(headchunk) % 4 == 0 and sizeof(wavechunk) % 4 == 0 */
-   newsamples = (Sint16 *)(void *) (wavebuffer + sizeof(headchunk)
-         + sizeof(wavechunk));
-   samplestep = (float) ORIGSAMPLERATE / (float)44100;
+   SD_Resample(origsamples, size, (Sint16 *)(void *) (wavebuffer
+            + sizeof(headchunk) + sizeof(wavechunk)), destsamples, padded);
+   free(padded);
+
+   /* the mixer keeps a converted copy of its own */
+   SoundChunks[which] = Mix_LoadWAV_RW(SDL_RWFromMem(wavebuffer, wavesize), 1);
+   free(wavebuffer);
+   SD_StoreSound(which);
+}
 
-   for(i=0; i<destsamples; i++, cursample+=samplestep)
+/*
+ * Sounds are converted on demand: SD_GetSoundChunk converts a sound the
+ * first time it is played, unless the prefetch thread started by
+ * SD_PrefetchSounds got to it first.
+ */
+static Mix_Chunk *SD_GetSoundChunk(int which)
+{
+   if(soundmutex)
+      LR_LockMutex(soundmutex);
+
+   while(SoundState[which] == SOUND_LOADING)
+      LR_CondWait(soundloaded, soundmutex);     /* the prefetch thread has it */
+
+   if(SoundState[which] != SOUND_READY)
    {
-      newsamples[i] = GetSample((float)size * (float)i / (float)destsamples,
-            origsamples, size);
+      SoundState[which] = SOUND_LOADING;
+      if(soundmutex)
+         LR_UnlockMutex(soundmutex);
+
+      SD_LoadSound(which);
+
+      if(soundmutex)
+         LR_LockMutex(soundmutex);
+      SoundState[which] = SOUND_READY;
+      if(soundloaded)
+         LR_CondBroadcast(soundloaded);
+   }
+
+   if(soundmutex)
+      LR_UnlockMutex(soundmutex);
+
+   return SoundChunks[which];
+}
+
+static void SD_PrefetchThread(void *data)
+{
+   int i;
+   boolean stop = false, wanted;
+   uint64_t start = LR_GetPerformanceCounter();
+
+   for(i = 0; i < NumDigi && !stop; i++)
+   {
+      LR_LockMutex(soundmutex);
+      stop   = prefetchstop;
+      wanted = SoundState[i] == SOUND_WANTED;
+      LR_UnlockMutex(soundmutex);
+
+      if(wanted && !stop)
+         SD_GetSoundChunk(i);
    }
-   SoundBuffers[which] = wavebuffer;
 
-   SoundChunks[which] = Mix_LoadWAV_RW(SDL_RWFromMem(wavebuffer,
-            sizeof(headchunk) + sizeof(wavechunk) + destsamples * 2), 1);
+   if(param_startuptrace)
+      printf("startup: %-18s %8.2f ms, in the background\n", "SD_PrefetchSounds",
+            (LR_GetPerformanceCounter() - start) / 1000.0);
+
+   /* remember them for the next start */
+   if(!stop)
+      CA_WriteAssetCache();
+}
+
+void SD_PrepareSound(int which)
+{
+   if(!SD_Started)
+      return;     /* no audio device, nothing to convert the sound for */
+
+   if(DigiList == NULL)
+      Quit("SD_PrepareSound(%i): DigiList not initialized!\n", which);
+
+   if(SoundState[which] == SOUND_UNUSED)
+      SoundState[which] = SOUND_WANTED;
+}
+
+/*
+ * Converts the sounds passed to SD_PrepareSound on a thread of its own,
+ * so they are ready before they are needed
+ */
+void SD_PrefetchSounds(void)
+{
+   if(!SD_Started || prefetchthread)
+      return;
+
+   soundmutex  = LR_CreateMutex();
+   soundloaded = LR_CreateCond();
+   if(soundmutex && soundloaded)
+      prefetchthread = LR_CreateThread(SD_PrefetchThread, NULL);
+
+   if(!prefetchthread)
+   {
+      /* only on demand then */
+      LR_DestroyCond(soundloaded);
+      LR_DestroyMutex(soundmutex);
+      soundloaded = NULL;
+      soundmutex  = NULL;
+   }
 }
 
 int SD_PlayDigitized(word which,int leftpos,int rightpos)
@@ -262,7 +564,7 @@ int SD_PlayDigitized(word which,int leftpos,int rightpos)
 
    DigiPlaying = true;
 
-   Mix_Chunk *sample = SoundChunks[which];
+   Mix_Chunk *sample = SD_GetSoundChunk(which);
    if(sample == NULL)
    {
       printf("SoundChunks[%i] is NULL!\n", which);
@@ -707,14 +1009,19 @@ void SD_Startup(void)
    if(Mix_OpenAudio(44100, AUDIO_S16, 2, 2048))
       return; /* Unable to open audio */
 
+   /* the device may have settled for another rate */
+   mixrate = 44100;
+   Mix_QuerySpec(&mixrate, NULL, NULL);
+   SD_SetupResampler();
+
    Mix_ReserveChannels(2);  /* reserve player and boss weapon channels */
    Mix_GroupChannels(2, MIX_CHANNELS-1, 1); /* group remaining channels */
 
    /* Initialize music */
 
-   samplesPerMusicTick = 44100 / 700; /*played at 700Hzs */
+   samplesPerMusicTick = mixrate / 700; /*played at 700Hzs */
 
-   if(YM3812Init(1, 3579545, 44100))
+   if(YM3812Init(1, 3579545, mixrate))
       printf("Unable to create virtual OPL!!\n");
 
    for(i=1;i<0xf6;i++)
@@ -752,12 +1059,25 @@ void SD_Shutdown(void)
    SD_MusicOff();
    SD_StopSound();
 
+   if(prefetchthread)
+   {
+      LR_LockMutex(soundmutex);
+      prefetchstop = true;
+      LR_UnlockMutex(soundmutex);
+      LR_WaitThread(prefetchthread);
+      prefetchthread = NULL;
+   }
+   LR_DestroyCond(soundloaded);
+   LR_DestroyMutex(soundmutex);
+   soundloaded = NULL;
+   soundmutex  = NULL;
+
    for(i = 0; i < STARTMUSIC - STARTDIGISOUNDS; i++)
    {
       if(SoundChunks[i])
          Mix_FreeChunk(SoundChunks[i]);
-      if(SoundBuffers[i])
-         free(SoundBuffers[i]);
+      SoundChunks[i] = NULL;
+      SoundState[i]  = SOUND_UNUSED;
    }
 
    free(DigiList);
@@ -150,6 +150,7 @@ extern  word    SD_SoundPlaying(void);
 
 extern  void    SD_SetDigiDevice(SDSMode);
 extern  void    SD_PrepareSound(int which);
+extern  void    SD_PrefetchSounds(void);
 extern  int     SD_PlayDigitized(word which,int leftpos,int rightpos);
 extern  void    SD_StopDigitized(void);
 
@@ -97,5 +97,6 @@ char            *USL_GiveSaveName(word game);
 
 void            US_InitRndT(int randomize);
 int             US_RndT();
+extern  int     rndindex;
 
 #endif
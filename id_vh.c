@@ -17,6 +17,7 @@ void VWB_DrawPropString(const char* string)
    fontstruct *font = (fontstruct *) grsegs[STARTFONT+fontnumber];
    int       height = font->height;
    byte       *dest = vbuf + scaleFactor * (py * curPitch + px);
+   int       startx = px;
 
    while ((ch = (byte)*string++) != 0)
    {
@@ -42,6 +43,8 @@ void VWB_DrawPropString(const char* string)
    }
 
    VL_UnlockSurface(curSurface);
+   VL_MarkDirty(scaleFactor * startx, scaleFactor * py,
+         scaleFactor * (px - startx), scaleFactor * height);
 }
 
 /*
@@ -106,8 +109,10 @@ void VW_MeasurePropString (const char *string, word *width, word *height)
 
 void VH_UpdateScreen(void)
 {
-   VL_ScreenToScreen(screenBuffer, screen);
-   LR_Flip(screen);
+   SDL_Rect rect;
+
+   if (VL_UpdateScreen(&rect))
+      LR_UpdateRect(screen, rect.x, rect.y, rect.w, rect.h);
 }
 
 
@@ -201,6 +206,64 @@ void LatchDrawPicScaledCoord (unsigned scx, unsigned scy, unsigned picnum)
 
 //==========================================================================
 
+/*
+===================
+=
+= LoadCachedLatch
+=
+= Fills a latch surface from the asset cache, returns false if it has to
+= be built from the graphics file
+=
+===================
+*/
+
+static boolean LoadCachedLatch (LR_Surface *surface, int latch)
+{
+   int y, width, height;
+   int32_t size;
+   byte *src;
+
+   width  = surface->surf->w;
+   height = surface->surf->h;
+   src    = CA_GetAsset(ASSET_LATCHPIC, latch, &size);
+   if(!src || size != width * height)
+      return false;
+
+   VL_LockSurface(surface);
+   for(y = 0; y < height; y++)
+      memcpy((byte *) surface->surf->pixels + y * surface->surf->pitch, src + y * width, width);
+   VL_UnlockSurface(surface);
+   return true;
+}
+
+/*
+===================
+=
+= StoreLatch
+=
+= Hands a freshly built latch surface to the asset cache
+=
+===================
+*/
+
+static void StoreLatch (LR_Surface *surface, int latch)
+{
+   int y, width, height;
+   byte *dest;
+
+   width  = surface->surf->w;
+   height = surface->surf->h;
+   dest   = (byte *) malloc(width * height);
+   CHECKMALLOCRESULT(dest);
+
+   VL_LockSurface(surface);
+   for(y = 0; y < height; y++)
+      memcpy(dest + y * width, (byte *) surface->surf->pixels + y * surface->surf->pitch, width);
+   VL_UnlockSurface(surface);
+
+   CA_AddAsset(ASSET_LATCHPIC, latch, dest, width * height);
+}
+
 /*
 ===================
 =
@@ -225,15 +288,19 @@ void LoadLatchMem (void)
    LR_SetColors(surface.surf, gamepal, 0, 256);
 
    latchpics[0].surf = surface.surf;
-   CA_CacheGrChunk (STARTTILE8);
-   src = grsegs[STARTTILE8];
-
-   for (i=0;i<NUMTILE8;i++)
+   if (!LoadCachedLatch (&surface, 0))
    {
-      VL_MemToLatch (src, 8, 8, &surface, (i & 7) * 8, (i >> 3) * 8);
-      src += 64;
+      CA_CacheGrChunk (STARTTILE8);
+      src = grsegs[STARTTILE8];
+
+      for (i=0;i<NUMTILE8;i++)
+      {
+         VL_MemToLatch (src, 8, 8, &surface, (i & 7) * 8, (i >> 3) * 8);
+         src += 64;
+      }
+      UNCACHEGRCHUNK (STARTTILE8);
+      StoreLatch (&surface, 0);
    }
-   UNCACHEGRCHUNK (STARTTILE8);
 
    /* pics */
    start = LATCHPICS_LUMP_START;
@@ -250,9 +317,13 @@ void LoadLatchMem (void)
       LR_SetColors(surface.surf, gamepal, 0, 256);
 
       latchpics[2+i-start].surf = surface.surf;
+      if (LoadCachedLatch (&surface, 2+i-start))
+         continue;
+
       CA_CacheGrChunk (i);
       VL_MemToLatch (grsegs[i], width, height, &surface, 0, 0);
       UNCACHEGRCHUNK(i);
+      StoreLatch (&surface, 2+i-start);
    }
 }
 
@@ -352,7 +423,7 @@ boolean FizzleFade (LR_Surface *source, int x1, int y1,
     * can't rely on screenBuffer as source for same reason: every flip it has to be updated
     */
    source_copy.surf = LR_ConvertSurface(source, source->surf->format, source->surf->flags);
-   screen_copy.surf = LR_ConvertSurface(screen, screen->surf->format, screen->surf->flags);
+   screen_copy.surf = VL_GrabScreen();
    srcptr      = VL_LockSurface(&source_copy);
 
    do
@@ -396,7 +467,7 @@ boolean FizzleFade (LR_Surface *source, int x1, int y1,
          /* copy one pixel */
          col     = *(srcptr + (y1 + y) * source->surf->pitch + x1 + x);
          fullcol = LR_MapRGB(screen->surf->format, curpal[col].r, curpal[col].g, curpal[col].b);
-         memcpy(destptr + (y1 + y) * screen->surf->pitch + (x1 + x) * screen->surf->format->BytesPerPixel,
+         memcpy(destptr + (y1 + y) * screen_copy.surf->pitch + (x1 + x) * screen->surf->format->BytesPerPixel,
                &fullcol, screen->surf->format->BytesPerPixel);
 
          if(rndval == 0)     /* entire sequence has been completed */
@@ -4,11 +4,19 @@
 #include "wl_def.h"
 #include "surface.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VL_NEON
+#endif
+
 boolean fullscreen = false;
 
 unsigned screenWidth = 320;
 unsigned screenHeight = 200;
 unsigned screenBits = -1;      // use "best" color depth according to libSDL
+unsigned outputScale = 1;      // screen is screenWidth*outputScale wide, see --renderres
 
 
 LR_Surface *screen = NULL;
@@ -28,6 +36,35 @@ unsigned bordercolor;
 LR_Color palette1[256], palette2[256];
 LR_Color curpal[256];
 
+typedef struct
+{
+   uint32_t lut[256];
+   uint16_t lut16[256];
+} screenlut_t;
+
+#define MAXCACHEDPALETTES 16
+
+/* screen LUTs prebuilt by VL_CachePalette, found by palette pointer */
+static LR_Color   *cachedpal[MAXCACHEDPALETTES];
+static screenlut_t cachedlut[MAXCACHEDPALETTES];
+static int         numcachedpal;
+
+/* built from curpal when the palette is not cached */
+static screenlut_t curlut;
+
+/* curpal in the pixel format of screen, see VL_UpdateScreen */
+static screenlut_t *screenlut = &curlut;
+
+/* the SDL palette of screenBuffer lags behind curpal until a blit needs it */
+static boolean palettestale;
+
+/* bounding box of everything drawn into screenBuffer since the last
+ * VL_UpdateScreen, empty when dirtyx1 >= dirtyx2 */
+static int dirtyx1, dirtyy1, dirtyx2, dirtyy2;
+
+static void VL_BuildScreenLUT (const LR_Color *palette, screenlut_t *lut);
+static void VL_SyncPalette (void);
+
 
 #define CASSERT(x) extern int ASSERT_COMPILE[((x) != 0) * 2 - 1];
 #define RGB(r, g, b) {(r)*255/63, (g)*255/63, (b)*255/63, 0}
@@ -79,13 +116,22 @@ void    VL_SetVGAPlaneMode (void)
 
    screen     = (LR_Surface*)calloc(1, sizeof(*screen));
 
-   screen->surf     = LR_SetVideoMode(screenWidth, screenHeight, screenBits, 0);
+   screen->surf     = LR_SetVideoMode(screenWidth * outputScale,
+         screenHeight * outputScale, screenBits, 0);
 
    if(!screen->surf)
       exit(1);
 
+   /* only the LUT expansion knows how to scale */
+   if(outputScale > 1 && screen->surf->format->BytesPerPixel != 2
+         && screen->surf->format->BytesPerPixel != 4)
+      Quit ("--renderres needs a 16 or 32 bit screen!");
+
    LR_SetColors(screen->surf, gamepal, 0, 256);
    memcpy(curpal, gamepal, sizeof(LR_Color) * 256);
+   VL_BuildScreenLUT(curpal, &curlut);
+   screenlut = &curlut;
+   VL_MarkScreenDirty();
 
    screenBuffer = (LR_Surface*)calloc(1, sizeof(*screenBuffer));
 
@@ -180,7 +226,10 @@ void VL_SetColor    (int color, int red, int green, int blue)
    LR_Color col = { red, green, blue };
    curpal[color] = col;
 
-   LR_SetPalette(curSurface->surf, SDL_LOGPAL, &col, color, 1);
+   VL_BuildScreenLUT(curpal, &curlut);
+   screenlut    = &curlut;
+   palettestale = true;
+   VL_MarkScreenDirty();
    VH_UpdateScreen();
 }
 
@@ -211,13 +260,62 @@ void VL_GetColor    (int color, int *red, int *green, int *blue)
 
 void VL_SetPalette (LR_Color *palette, bool forceupdate)
 {
+   int i;
+
    memcpy(curpal, palette, sizeof(LR_Color) * 256);
 
-   LR_SetPalette(curSurface->surf, SDL_LOGPAL, palette, 0, 256);
+   for (i = 0; i < numcachedpal; i++)
+   {
+      if (cachedpal[i] == palette)
+         break;
+   }
+
+   if (i < numcachedpal)
+      screenlut = &cachedlut[i];
+   else
+   {
+      VL_BuildScreenLUT(curpal, &curlut);
+      screenlut = &curlut;
+   }
+
+   palettestale = true;
+   VL_MarkScreenDirty();
    if (forceupdate)
       VH_UpdateScreen();
 }
 
+/*
+=================
+=
+= VL_CachePalette
+=
+= Prebuilds the screen LUT for a palette that is set over and over, so
+= VL_SetPalette only has to select it.  The palette must not change
+= afterwards without being cached again.
+=
+=================
+*/
+
+void VL_CachePalette (LR_Color *palette)
+{
+   int i;
+
+   for (i = 0; i < numcachedpal; i++)
+   {
+      if (cachedpal[i] == palette)
+         break;
+   }
+
+   if (i == numcachedpal)
+   {
+      if (numcachedpal == MAXCACHEDPALETTES)
+         Quit ("VL_CachePalette: Too many cached palettes!");
+      cachedpal[numcachedpal++] = palette;
+   }
+
+   VL_BuildScreenLUT(palette, &cachedlut[i]);
+}
+
 /*
 =================
 =
@@ -358,6 +456,7 @@ void VL_Plot (int x, int y, int color)
    VL_LockSurface(curSurface);
    ((byte *) curSurface->surf->pixels)[y * curPitch + x] = color;
    VL_UnlockSurface(curSurface);
+   VL_MarkDirty(x, y, 1, 1);
 }
 
 /*
@@ -402,6 +501,7 @@ void VL_Hlin (unsigned x, unsigned y, unsigned width, int color)
    dest = ((byte *) curSurface->surf->pixels) + y * curPitch + x;
    memset(dest, color, width);
    VL_UnlockSurface(curSurface);
+   VL_MarkDirty(x, y, width, 1);
 }
 
 
@@ -424,6 +524,8 @@ void VL_Vlin (int x, int y, int height, int color)
    VL_LockSurface(curSurface);
    dest = ((byte *) curSurface->surf->pixels) + y * curPitch + x;
 
+   VL_MarkDirty(x, y, 1, height);
+
    while (height--)
    {
       *dest = color;
@@ -451,6 +553,7 @@ void VL_BarScaledCoord (int scx, int scy, int scwidth, int scheight, int color)
 
    VL_LockSurface(curSurface);
    dest = ((byte *) curSurface->surf->pixels) + scy * curPitch + scx;
+   VL_MarkDirty(scx, scy, scwidth, scheight);
 
    while (scheight--)
    {
@@ -522,6 +625,7 @@ void VL_MemToScreenScaledCoord (byte *source, int width, int height, int destx,
 
    VL_LockSurface(curSurface);
    vbuf = (byte *) curSurface->surf->pixels;
+   VL_MarkDirty(destx, desty, width * scaleFactor, height * scaleFactor);
 
    for(j = 0, scj = 0; j < height; j++, scj += scaleFactor)
    {
@@ -563,6 +667,7 @@ void VL_MemToScreenScaledCoord2 (byte *source, int origwidth, int origheight, in
 
    VL_LockSurface(curSurface);
    vbuf = (byte *) curSurface->surf->pixels;
+   VL_MarkDirty(destx, desty, width * scaleFactor, height * scaleFactor);
 
    for(j = 0,scj = 0; j < height; j++, scj += scaleFactor)
    {
@@ -604,6 +709,7 @@ void VL_LatchToScreenScaledCoord(LR_Surface *source, int xsrc, int ysrc,
 
    VL_LockSurface(curSurface);
    vbuf = (byte *) curSurface->surf->pixels;
+   VL_MarkDirty(scxdest, scydest, width * scaleFactor, height * scaleFactor);
 
    for(j = 0, scj = 0; j < height; j++, scj += scaleFactor)
    {
@@ -631,5 +737,477 @@ void VL_LatchToScreenScaledCoord(LR_Surface *source, int xsrc, int ysrc,
 
 void VL_ScreenToScreen (LR_Surface *source, LR_Surface *dest)
 {
+   VL_SyncPalette();
    LR_BlitSurface(source, NULL, dest, NULL);
+
+   if (dest->surf == screenBuffer->surf)
+      VL_MarkScreenDirty();
+}
+
+/*
+=============================================================================
+
+                            SCREEN UPDATE
+
+        screenBuffer is expanded straight into the screen surface through
+        screenlut, which holds the current palette in the screen's pixel
+        format.  Palettes passed to VL_CachePalette (the game palette and
+        the damage and bonus flashes) have their LUT built once, any other
+        palette gets it rebuilt when it is set.
+
+        Everything that draws into screenBuffer calls VL_MarkDirty, so an
+        update only converts and flips the area that changed since the
+        last one.  A palette change marks the whole screen.
+
+        With --renderres the game draws at screenWidth x screenHeight and
+        screen is outputScale times that size.  The expansion writes
+        every pixel outputScale times and copies every row outputScale
+        times, so scaling costs no extra pass over the screen.
+
+=============================================================================
+*/
+
+/*
+=================
+=
+= VL_BuildScreenLUT
+=
+=================
+*/
+
+static void VL_BuildScreenLUT (const LR_Color *palette, screenlut_t *lut)
+{
+   int i;
+
+   for (i = 0; i < 256; i++)
+   {
+      lut->lut[i]   = LR_MapRGB(screen->surf->format, palette[i].r, palette[i].g, palette[i].b);
+      lut->lut16[i] = (uint16_t) lut->lut[i];
+   }
+}
+
+/*
+=================
+=
+= VL_SyncPalette
+=
+= Hands curpal to SDL before screenBuffer is blitted
+=
+=================
+*/
+
+static void VL_SyncPalette (void)
+{
+   if (!palettestale)
+      return;
+
+   LR_SetPalette(screenBuffer->surf, SDL_LOGPAL, curpal, 0, 256);
+   palettestale = false;
+}
+
+/*
+=================
+=
+= VL_MarkDirty
+=
+= Adds a rectangle of screenBuffer to the area converted by the next update
+=
+=================
+*/
+
+void VL_MarkDirty (int x, int y, int width, int height)
+{
+   int x2 = x + width;
+   int y2 = y + height;
+
+   if (x < 0)
+      x = 0;
+   if (y < 0)
+      y = 0;
+   if (x2 > (int) screenWidth)
+      x2 = screenWidth;
+   if (y2 > (int) screenHeight)
+      y2 = screenHeight;
+   if (x >= x2 || y >= y2)
+      return;
+
+   if (dirtyx1 >= dirtyx2)
+   {
+      dirtyx1 = x;
+      dirtyy1 = y;
+      dirtyx2 = x2;
+      dirtyy2 = y2;
+      return;
+   }
+
+   if (x < dirtyx1)
+      dirtyx1 = x;
+   if (y < dirtyy1)
+      dirtyy1 = y;
+   if (x2 > dirtyx2)
+      dirtyx2 = x2;
+   if (y2 > dirtyy2)
+      dirtyy2 = y2;
+}
+
+static void VL_ExpandRow16 (uint16_t *dest, const byte *src, int width)
+{
+   const uint16_t *lut = screenlut->lut16;
+
+#if defined(__SSE2__)
+   for (; width >= 8; width -= 8, src += 8, dest += 8)
+      _mm_storeu_si128((__m128i *) dest, _mm_setr_epi16(
+               lut[src[0]], lut[src[1]], lut[src[2]], lut[src[3]],
+               lut[src[4]], lut[src[5]], lut[src[6]], lut[src[7]]));
+#elif defined(VL_NEON)
+   for (; width >= 8; width -= 8, src += 8, dest += 8)
+   {
+      uint16x8_t v = vdupq_n_u16(lut[src[0]]);
+      v = vsetq_lane_u16(lut[src[1]], v, 1);
+      v = vsetq_lane_u16(lut[src[2]], v, 2);
+      v = vsetq_lane_u16(lut[src[3]], v, 3);
+      v = vsetq_lane_u16(lut[src[4]], v, 4);
+      v = vsetq_lane_u16(lut[src[5]], v, 5);
+      v = vsetq_lane_u16(lut[src[6]], v, 6);
+      v = vsetq_lane_u16(lut[src[7]], v, 7);
+      vst1q_u16(dest, v);
+   }
+#endif
+
+   while (width--)
+      *dest++ = lut[*src++];
+}
+
+static void VL_ExpandRow32 (uint32_t *dest, const byte *src, int width)
+{
+   const uint32_t *lut = screenlut->lut;
+
+#if defined(__SSE2__)
+   for (; width >= 4; width -= 4, src += 4, dest += 4)
+      _mm_storeu_si128((__m128i *) dest, _mm_setr_epi32(
+               lut[src[0]], lut[src[1]], lut[src[2]], lut[src[3]]));
+#elif defined(VL_NEON)
+   for (; width >= 4; width -= 4, src += 4, dest += 4)
+   {
+      uint32x4_t v = vdupq_n_u32(lut[src[0]]);
+      v = vsetq_lane_u32(lut[src[1]], v, 1);
+      v = vsetq_lane_u32(lut[src[2]], v, 2);
+      v = vsetq_lane_u32(lut[src[3]], v, 3);
+      vst1q_u32(dest, v);
+   }
+#endif
+
+   while (width--)
+      *dest++ = lut[*src++];
+}
+
+/*
+=================
+=
+= VL_ExpandRowScaled16
+=
+= VL_ExpandRow16 writing every pixel scale times
+=
+=================
+*/
+
+static void VL_ExpandRowScaled16 (uint16_t *dest, const byte *src, int width, int scale)
+{
+   const uint16_t *lut = screenlut->lut16;
+   uint16_t c;
+   int      i;
+
+#if defined(__SSE2__)
+   if (scale == 2 || scale == 4)
+   {
+      for (; width >= 8; width -= 8, src += 8)
+      {
+         __m128i v  = _mm_setr_epi16(
+               lut[src[0]], lut[src[1]], lut[src[2]], lut[src[3]],
+               lut[src[4]], lut[src[5]], lut[src[6]], lut[src[7]]);
+         __m128i lo = _mm_unpacklo_epi16(v, v);
+         __m128i hi = _mm_unpackhi_epi16(v, v);
+
+         if (scale == 2)
+         {
+            _mm_storeu_si128((__m128i *) dest, lo);
+            _mm_storeu_si128((__m128i *) (dest + 8), hi);
+            dest += 16;
+         }
+         else
+         {
+            _mm_storeu_si128((__m128i *) dest, _mm_unpacklo_epi32(lo, lo));
+            _mm_storeu_si128((__m128i *) (dest + 8), _mm_unpackhi_epi32(lo, lo));
+            _mm_storeu_si128((__m128i *) (dest + 16), _mm_unpacklo_epi32(hi, hi));
+            _mm_storeu_si128((__m128i *) (dest + 24), _mm_unpackhi_epi32(hi, hi));
+            dest += 32;
+         }
+      }
+   }
+#elif defined(VL_NEON)
+   if (scale == 2 || scale == 4)
+   {
+      for (; width >= 8; width -= 8, src += 8)
+      {
+         uint16x8_t   v = vdupq_n_u16(lut[src[0]]);
+         uint16x8x2_t d;
+
+         v = vsetq_lane_u16(lut[src[1]], v, 1);
+         v = vsetq_lane_u16(lut[src[2]], v, 2);
+         v = vsetq_lane_u16(lut[src[3]], v, 3);
+         v = vsetq_lane_u16(lut[src[4]], v, 4);
+         v = vsetq_lane_u16(lut[src[5]], v, 5);
+         v = vsetq_lane_u16(lut[src[6]], v, 6);
+         v = vsetq_lane_u16(lut[src[7]], v, 7);
+         d = vzipq_u16(v, v);
+
+         if (scale == 2)
+         {
+            vst1q_u16(dest, d.val[0]);
+            vst1q_u16(dest + 8, d.val[1]);
+            dest += 16;
+         }
+         else
+         {
+            uint16x8x2_t lo = vzipq_u16(d.val[0], d.val[0]);
+            uint16x8x2_t hi = vzipq_u16(d.val[1], d.val[1]);
+
+            vst1q_u16(dest, lo.val[0]);
+            vst1q_u16(dest + 8, lo.val[1]);
+            vst1q_u16(dest + 16, hi.val[0]);
+            vst1q_u16(dest + 24, hi.val[1]);
+            dest += 32;
+         }
+      }
+   }
+#endif
+
+   while (width--)
+   {
+      c = lut[*src++];
+      for (i = 0; i < scale; i++)
+         *dest++ = c;
+   }
+}
+
+/*
+=================
+=
+= VL_ExpandRowScaled32
+=
+=================
+*/
+
+static void VL_ExpandRowScaled32 (uint32_t *dest, const byte *src, int width, int scale)
+{
+   const uint32_t *lut = screenlut->lut;
+   uint32_t c;
+   int      i;
+
+#if defined(__SSE2__)
+   if (scale == 2 || scale == 4)
+   {
+      for (; width >= 4; width -= 4, src += 4)
+      {
+         __m128i v = _mm_setr_epi32(lut[src[0]], lut[src[1]], lut[src[2]], lut[src[3]]);
+
+         if (scale == 2)
+         {
+            _mm_storeu_si128((__m128i *) dest, _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i *) (dest + 4), _mm_unpackhi_epi32(v, v));
+            dest += 8;
+         }
+         else
+         {
+            _mm_storeu_si128((__m128i *) dest, _mm_shuffle_epi32(v, 0x00));
+            _mm_storeu_si128((__m128i *) (dest + 4), _mm_shuffle_epi32(v, 0x55));
+            _mm_storeu_si128((__m128i *) (dest + 8), _mm_shuffle_epi32(v, 0xaa));
+            _mm_storeu_si128((__m128i *) (dest + 12), _mm_shuffle_epi32(v, 0xff));
+            dest += 16;
+         }
+      }
+   }
+#elif defined(VL_NEON)
+   if (scale == 2 || scale == 4)
+   {
+      for (; width >= 4; width -= 4, src += 4)
+      {
+         uint32x4_t   v = vdupq_n_u32(lut[src[0]]);
+         uint32x4x2_t d;
+
+         v = vsetq_lane_u32(lut[src[1]], v, 1);
+         v = vsetq_lane_u32(lut[src[2]], v, 2);
+         v = vsetq_lane_u32(lut[src[3]], v, 3);
+         d = vzipq_u32(v, v);
+
+         if (scale == 2)
+         {
+            vst1q_u32(dest, d.val[0]);
+            vst1q_u32(dest + 4, d.val[1]);
+            dest += 8;
+         }
+         else
+         {
+            uint32x4x2_t lo = vzipq_u32(d.val[0], d.val[0]);
+            uint32x4x2_t hi = vzipq_u32(d.val[1], d.val[1]);
+
+            vst1q_u32(dest, lo.val[0]);
+            vst1q_u32(dest + 4, lo.val[1]);
+            vst1q_u32(dest + 8, hi.val[0]);
+            vst1q_u32(dest + 12, hi.val[1]);
+            dest += 16;
+         }
+      }
+   }
+#endif
+
+   while (width--)
+   {
+      c = lut[*src++];
+      for (i = 0; i < scale; i++)
+         *dest++ = c;
+   }
+}
+
+/*
+=================
+=
+= VL_UpdateScreenScaled
+=
+= VL_UpdateScreen for --renderres, rect is in screen pixels
+=
+=================
+*/
+
+static void VL_UpdateScreenScaled (SDL_Rect *rect)
+{
+   int      y, i, width = dirtyx2 - dirtyx1;
+   unsigned bpp = screen->surf->format->BytesPerPixel;
+   unsigned rowbytes = width * outputScale * bpp;
+   byte    *src, *dest;
+
+   rect->x = dirtyx1 * outputScale;
+   rect->y = dirtyy1 * outputScale;
+   rect->w = width * outputScale;
+   rect->h = (dirtyy2 - dirtyy1) * outputScale;
+
+   src  = VL_LockSurface(screenBuffer) + dirtyy1 * bufferPitch + dirtyx1;
+   dest = VL_LockSurface(screen) + rect->y * screenPitch + rect->x * bpp;
+
+   for (y = dirtyy1; y < dirtyy2; y++, src += bufferPitch)
+   {
+      if (bpp == 2)
+         VL_ExpandRowScaled16((uint16_t *) dest, src, width, outputScale);
+      else
+         VL_ExpandRowScaled32((uint32_t *) dest, src, width, outputScale);
+
+      for (i = 1; i < (int) outputScale; i++)
+         memcpy(dest + i * screenPitch, dest, rowbytes);
+      dest += outputScale * screenPitch;
+   }
+
+   VL_UnlockSurface(screen);
+   VL_UnlockSurface(screenBuffer);
+}
+
+/*
+=================
+=
+= VL_GrabScreen
+=
+= Returns a copy of screen at screenWidth x screenHeight, taking every
+= outputScale'th pixel when the screen is scaled up
+=
+=================
+*/
+
+SDL_Surface *VL_GrabScreen (void)
+{
+   SDL_PixelFormat *fmt = screen->surf->format;
+   LR_Surface       copy;
+   byte            *src, *dest;
+   unsigned         x, y, bpp = fmt->BytesPerPixel;
+
+   if (outputScale == 1)
+      return LR_ConvertSurface(screen, fmt, screen->surf->flags);
+
+   copy.surf = LR_CreateRGBSurface(SDL_SWSURFACE, screenWidth, screenHeight,
+         fmt->BitsPerPixel, fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
+   if (!copy.surf)
+      return NULL;
+
+   src  = VL_LockSurface(screen);
+   dest = VL_LockSurface(&copy);
+   for (y = 0; y < screenHeight; y++)
+   {
+      const byte *srcrow  = src + y * outputScale * screenPitch;
+      byte       *destrow = dest + y * copy.surf->pitch;
+
+      for (x = 0; x < screenWidth; x++)
+         memcpy(destrow + x * bpp, srcrow + x * outputScale * bpp, bpp);
+   }
+   VL_UnlockSurface(&copy);
+   VL_UnlockSurface(screen);
+
+   return copy.surf;
+}
+
+/*
+=================
+=
+= VL_UpdateScreen
+=
+= Converts the dirty area of screenBuffer into screen and returns it in
+= rect for the caller to flip.  Returns false if nothing changed.
+=
+=================
+*/
+
+boolean VL_UpdateScreen (SDL_Rect *rect)
+{
+   int      y, width;
+   unsigned bpp = screen->surf->format->BytesPerPixel;
+   byte    *src, *dest;
+   SDL_Rect blitrect;
+
+   if (dirtyx1 >= dirtyx2)
+      return false;
+
+   if (outputScale > 1)
+   {
+      VL_UpdateScreenScaled(rect);
+      dirtyx1 = dirtyy1 = dirtyx2 = dirtyy2 = 0;
+      return true;
+   }
+
+   rect->x = dirtyx1;
+   rect->y = dirtyy1;
+   rect->w = width = dirtyx2 - dirtyx1;
+   rect->h = dirtyy2 - dirtyy1;
+
+   src  = VL_LockSurface(screenBuffer) + dirtyy1 * bufferPitch + dirtyx1;
+   dest = VL_LockSurface(screen) + dirtyy1 * screenPitch + dirtyx1 * bpp;
+
+   switch (bpp)
+   {
+      case 2:
+         for (y = dirtyy1; y < dirtyy2; y++, src += bufferPitch, dest += screenPitch)
+            VL_ExpandRow16((uint16_t *) dest, src, width);
+         break;
+      case 4:
+         for (y = dirtyy1; y < dirtyy2; y++, src += bufferPitch, dest += screenPitch)
+            VL_ExpandRow32((uint32_t *) dest, src, width);
+         break;
+      default:
+         blitrect = *rect;
+         VL_SyncPalette();
+         LR_BlitSurface(screenBuffer, &blitrect, screen, &blitrect);
+         break;
+   }
+
+   VL_UnlockSurface(screen);
+   VL_UnlockSurface(screenBuffer);
+
+   dirtyx1 = dirtyy1 = dirtyx2 = dirtyy2 = 0;
+   return true;
 }
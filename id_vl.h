@@ -26,6 +26,7 @@ extern LR_Surface *screen, *screenBuffer, *curSurface;
 extern  boolean  fullscreen;
 extern  unsigned screenWidth, screenHeight, screenBits, screenPitch, bufferPitch, curPitch;
 extern  unsigned scaleFactor;
+extern  unsigned outputScale;
 
 extern  boolean  screenfaded;
 extern  unsigned bordercolor;
@@ -49,6 +50,7 @@ void VL_FillPalette (int red, int green, int blue);
 void VL_SetColor    (int color, int red, int green, int blue);
 void VL_GetColor    (int color, int *red, int *green, int *blue);
 void VL_SetPalette  (LR_Color *palette, bool forceupdate);
+void VL_CachePalette (LR_Color *palette);
 void VL_GetPalette  (LR_Color *palette);
 void VL_FadeOut     (int start, int end, int red, int green, int blue, int steps);
 void VL_FadeIn      (int start, int end, LR_Color *palette, int steps);
@@ -68,9 +70,17 @@ static inline void VL_Bar      (int x, int y, int width, int height, int color)
          scaleFactor*width, scaleFactor*height, color);
 }
 
+void VL_MarkDirty       (int x, int y, int width, int height);
+
+static inline void VL_MarkScreenDirty (void)
+{
+   VL_MarkDirty(0, 0, screenWidth, screenHeight);
+}
+
 static inline void VL_ClearScreen(int color)
 {
    LR_FillRect(curSurface, NULL, color);
+   VL_MarkScreenDirty();
 }
 
 void VL_MungePic                (byte *source, unsigned width, unsigned height);
@@ -78,6 +88,8 @@ void VL_DrawPicBare             (int x, int y, byte *pic, int width, int height)
 void VL_MemToLatch              (byte *source, int width, int height,
                                     LR_Surface *destSurface, int x, int y);
 void VL_ScreenToScreen          (LR_Surface *source, LR_Surface *dest);
+boolean VL_UpdateScreen         (SDL_Rect *rect);
+SDL_Surface *VL_GrabScreen      (void);
 void VL_MemToScreenScaledCoord  (byte *source, int width, int height, int scx, int scy);
 void VL_MemToScreenScaledCoord2  (byte *source, int origwidth, int origheight, int srcx, int srcy,
                                     int destx, int desty, int width, int height);
@@ -16,6 +16,12 @@
 #include <time.h>
 #endif
 
+#ifdef HAVE_THREADS
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #include "surface.h"
 
 typedef uint64_t retro_perf_tick_t;
@@ -97,12 +103,17 @@ static retro_perf_tick_t rarch_get_perf_counter(void)
    time_ticks = (1000000 * tv_sec + tv_usec);
 #endif
 
-   return time_ticks / 1000000;
+   return time_ticks / 1000;
 }
 
 uint32_t LR_GetTicks(void)
 {
-   return (uint32_t)rarch_get_perf_counter();
+   return (uint32_t)(rarch_get_perf_counter() / 1000);
+}
+
+uint64_t LR_GetPerformanceCounter(void)
+{
+   return rarch_get_perf_counter();
 }
 
 void LR_FillRect(LR_Surface *surface, const void *rect_data, uint32_t color)
@@ -133,6 +144,12 @@ int LR_SetColors(SDL_Surface *surface, LR_Color *colors, int firstcolor, int nco
    return SDL_SetColors(surface, (SDL_Color*)colors, firstcolor, ncolors);
 }
 
+void LR_SetOffscreen(void)
+{
+   static char videodriver[] = "SDL_VIDEODRIVER=dummy";
+   SDL_putenv(videodriver);
+}
+
 int LR_Init(uint32_t flags)
 {
    return SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
@@ -170,6 +187,11 @@ int LR_Flip(LR_Surface *screen)
    return SDL_Flip(screen->surf);
 }
 
+void LR_UpdateRect(LR_Surface *screen, int x, int y, int w, int h)
+{
+   SDL_UpdateRect(screen->surf, x, y, w, h);
+}
+
 SDL_Surface *LR_SetVideoMode(int width, int height, int bpp, uint32_t flags)
 {
    return SDL_SetVideoMode(width, height, bpp, flags);
@@ -184,3 +206,175 @@ uint32_t LR_MapRGB(SDL_PixelFormat *fmt, uint8_t r, uint8_t g, uint8_t b)
 {
    return SDL_MapRGB(fmt, r, g, b);
 }
+
+#ifdef HAVE_THREADS
+struct LR_Thread
+{
+   pthread_t id;
+   void (*fn)(void *);
+   void *data;
+};
+
+struct LR_Mutex
+{
+   pthread_mutex_t id;
+};
+
+struct LR_Cond
+{
+   pthread_cond_t id;
+};
+
+static void *LR_ThreadEntry(void *data)
+{
+   LR_Thread *thread = (LR_Thread*)data;
+   thread->fn(thread->data);
+   return NULL;
+}
+
+int LR_GetCPUCount(void)
+{
+   long count = sysconf(_SC_NPROCESSORS_ONLN);
+   return count < 1 ? 1 : (int)count;
+}
+
+LR_Thread *LR_CreateThread(void (*fn)(void *), void *data)
+{
+   LR_Thread *thread = (LR_Thread*)malloc(sizeof(*thread));
+   if (!thread)
+      return NULL;
+
+   thread->fn   = fn;
+   thread->data = data;
+
+   if (pthread_create(&thread->id, NULL, LR_ThreadEntry, thread) != 0)
+   {
+      free(thread);
+      return NULL;
+   }
+   return thread;
+}
+
+void LR_WaitThread(LR_Thread *thread)
+{
+   if (!thread)
+      return;
+   pthread_join(thread->id, NULL);
+   free(thread);
+}
+
+LR_Mutex *LR_CreateMutex(void)
+{
+   LR_Mutex *mutex = (LR_Mutex*)malloc(sizeof(*mutex));
+   if (mutex && pthread_mutex_init(&mutex->id, NULL) != 0)
+   {
+      free(mutex);
+      return NULL;
+   }
+   return mutex;
+}
+
+void LR_DestroyMutex(LR_Mutex *mutex)
+{
+   if (!mutex)
+      return;
+   pthread_mutex_destroy(&mutex->id);
+   free(mutex);
+}
+
+void LR_LockMutex(LR_Mutex *mutex)
+{
+   pthread_mutex_lock(&mutex->id);
+}
+
+void LR_UnlockMutex(LR_Mutex *mutex)
+{
+   pthread_mutex_unlock(&mutex->id);
+}
+
+LR_Cond *LR_CreateCond(void)
+{
+   LR_Cond *cond = (LR_Cond*)malloc(sizeof(*cond));
+   if (cond && pthread_cond_init(&cond->id, NULL) != 0)
+   {
+      free(cond);
+      return NULL;
+   }
+   return cond;
+}
+
+void LR_DestroyCond(LR_Cond *cond)
+{
+   if (!cond)
+      return;
+   pthread_cond_destroy(&cond->id);
+   free(cond);
+}
+
+void LR_CondWait(LR_Cond *cond, LR_Mutex *mutex)
+{
+   pthread_cond_wait(&cond->id, &mutex->id);
+}
+
+void LR_CondSignal(LR_Cond *cond)
+{
+   pthread_cond_signal(&cond->id);
+}
+
+void LR_CondBroadcast(LR_Cond *cond)
+{
+   pthread_cond_broadcast(&cond->id);
+}
+#else
+int LR_GetCPUCount(void)
+{
+   return 1;
+}
+
+LR_Thread *LR_CreateThread(void (*fn)(void *), void *data)
+{
+   return NULL;
+}
+
+void LR_WaitThread(LR_Thread *thread)
+{
+}
+
+LR_Mutex *LR_CreateMutex(void)
+{
+   return NULL;
+}
+
+void LR_DestroyMutex(LR_Mutex *mutex)
+{
+}
+
+void LR_LockMutex(LR_Mutex *mutex)
+{
+}
+
+void LR_UnlockMutex(LR_Mutex *mutex)
+{
+}
+
+LR_Cond *LR_CreateCond(void)
+{
+   return NULL;
+}
+
+void LR_DestroyCond(LR_Cond *cond)
+{
+}
+
+void LR_CondWait(LR_Cond *cond, LR_Mutex *mutex)
+{
+}
+
+void LR_CondSignal(LR_Cond *cond)
+{
+}
+
+void LR_CondBroadcast(LR_Cond *cond)
+{
+}
+#endif
@@ -29,6 +29,9 @@ typedef struct LR_Color
 
 uint32_t LR_GetTicks(void);
 
+/* microseconds, for timing parts of a frame */
+uint64_t LR_GetPerformanceCounter(void);
+
 void LR_FillRect(LR_Surface *surface, const void *rect_data, uint32_t color);
 
 void LR_Delay(Uint32 ms);
@@ -37,6 +40,9 @@ void LR_SetPalette(SDL_Surface *surface, int flags, LR_Color *colors, int firstc
 
 int LR_SetColors(SDL_Surface *surface, LR_Color *colors, int firstcolor, int ncolors);
 
+/* use SDL's dummy video driver, must be called before LR_Init */
+void LR_SetOffscreen(void);
+
 int LR_Init(uint32_t flags);
 
 void LR_Quit(void);
@@ -56,10 +62,43 @@ int LR_BlitSurface(LR_Surface *src, SDL_Rect *srcrect, LR_Surface *dst, SDL_Rect
 
 int LR_Flip(LR_Surface *screen);
 
+void LR_UpdateRect(LR_Surface *screen, int x, int y, int w, int h);
+
 SDL_Surface *LR_SetVideoMode(int width, int height, int bpp, uint32_t flags);
 
 SDL_Surface *LR_ConvertSurface(LR_Surface *src, SDL_PixelFormat *fmt, uint32_t flags);
 
 uint32_t LR_MapRGB(SDL_PixelFormat *fmt, uint8_t r, uint8_t g, uint8_t b);
 
+/* Threads are only available when built with HAVE_THREADS; otherwise
+ * the create functions return NULL and LR_GetCPUCount returns 1, so
+ * callers fall back to doing the work on the calling thread. */
+typedef struct LR_Thread LR_Thread;
+typedef struct LR_Mutex  LR_Mutex;
+typedef struct LR_Cond   LR_Cond;
+
+int LR_GetCPUCount(void);
+
+LR_Thread *LR_CreateThread(void (*fn)(void *), void *data);
+
+void LR_WaitThread(LR_Thread *thread);
+
+LR_Mutex *LR_CreateMutex(void);
+
+void LR_DestroyMutex(LR_Mutex *mutex);
+
+void LR_LockMutex(LR_Mutex *mutex);
+
+void LR_UnlockMutex(LR_Mutex *mutex);
+
+LR_Cond *LR_CreateCond(void);
+
+void LR_DestroyCond(LR_Cond *cond);
+
+void LR_CondWait(LR_Cond *cond, LR_Mutex *mutex);
+
+void LR_CondSignal(LR_Cond *cond);
+
+void LR_CondBroadcast(LR_Cond *cond);
+
 #endif
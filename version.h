@@ -32,6 +32,7 @@
 //#define FIXRAINSNOWLEAKS    // Enables leaking ceilings fix (by Adam Biser, only needed if maps with rain/snow and ceilings exist)
 
 #define DEBUGKEYS             // Comment this out to compile without the Tab debug keys
+#define ZONEPROFILER          // Comment this out to compile without the --profile frame zone timers
 #define ARTSEXTERN
 #define DEMOSEXTERN
 #define PLAYDEMOLIKEORIGINAL  // When playing or recording demos, several bug fixes do not take
@@ -188,6 +188,59 @@ void SpawnStatic (int tilex, int tiley, int type)
 }
 
 
+/*
+===============
+=
+= SpawnBenchStatics
+=
+= Scatters count harmless statics over the open floor around the player,
+= so --spritebench has plenty of visible objects to sort
+=
+===============
+*/
+
+void SpawnBenchStatics (int count)
+{
+   static const int benchtypes[4] = {0, 4, 9, 14};   // puddle, chandelier, skeleton, light
+   static byte      seen[MAPSIZE][MAPSIZE];
+   static word      floortiles[MAPSIZE*MAPSIZE];
+   int numtiles, i, n, x, y, dir;
+
+   memset (seen,0,sizeof(seen));
+   floortiles[0] = (player->tilex<<mapshift) + player->tiley;
+   seen[player->tilex][player->tiley] = 1;
+   numtiles = 1;
+
+   // flood fill the open tiles until a wall or door is hit
+   for (i = 0; i < numtiles; i++)
+   {
+      for (dir = 0; dir < 4; dir++)
+      {
+         x = (floortiles[i]>>mapshift) + (dir == 0) - (dir == 1);
+         y = (floortiles[i]&(MAPSIZE-1)) + (dir == 2) - (dir == 3);
+
+         if (x < 1 || y < 1 || x >= MAPSIZE - 1 || y >= MAPSIZE - 1)
+            continue;
+         if (seen[x][y] || tilemap[x][y])
+            continue;
+
+         seen[x][y] = 1;
+         floortiles[numtiles++] = (x<<mapshift) + y;
+      }
+   }
+
+   // the player's own tile is too close to be drawn
+   for (n = 0; n < count && numtiles > 1; n++)
+   {
+      if (laststatobj == &statobjlist[MAXSTATS-1])
+         break;
+
+      i = 1 + n % (numtiles - 1);
+      SpawnStatic (floortiles[i]>>mapshift, floortiles[i]&(MAPSIZE-1), benchtypes[n & 3]);
+   }
+}
+
+
 /*
 ===============
 =
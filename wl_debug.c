@@ -62,7 +62,7 @@ void CountObjects (void)
     int     i,total,count,active,inactive,doors;
     objtype *obj;
 
-    CenterWindow (17,7);
+    CenterWindow (17,8);
     active = inactive = count = doors = 0;
 
     US_Print ("Total statics :");
@@ -100,6 +100,10 @@ void CountObjects (void)
     US_Print ("\nActive actors :");
     US_PrintUnsigned (active);
 
+    US_Print ("\nSprite cache  :");
+    US_PrintUnsigned (SpriteCacheSize()/1024);
+    US_Print ("K");
+
     VW_UpdateScreen();
     IN_Ack ();
 }
@@ -484,6 +488,19 @@ again:
         IN_Ack ();
         return 1;
     }
+#ifdef ZONEPROFILER
+    else if (Keyboard[sc_Z])        // Z = write zone profile
+    {
+        CenterWindow (20,3);
+        if (WriteProfile ())
+            US_PrintCentered ("Profile written");
+        else
+            US_PrintCentered ("Nothing to profile");
+        VW_UpdateScreen();
+        IN_Ack ();
+        return 1;
+    }
+#endif
 
 
     return 0;
@@ -901,6 +901,21 @@ extern  int      param_joystickhat;
 extern  int      param_mission;
 extern  boolean  param_goodtimes;
 extern  boolean  param_ignorenumchunks;
+extern  int      param_threads;
+extern  int      param_spritebench;
+extern  boolean  param_transposed;
+extern  int      param_viewbench;
+extern  int      param_timedemo;
+extern  char    *param_demofile;
+extern  boolean  param_interpolate;
+extern  boolean  param_pipeline;
+extern  char    *param_record;
+extern  int      param_wallmips;
+extern  boolean  param_nommap;
+extern  int      param_huffbench;
+extern  boolean  param_startuptrace;
+
+enum { WALLMIPS_OFF, WALLMIPS_NEAREST, WALLMIPS_FILTER };
 
 
 void            NewGame (int difficulty,int episode);
@@ -910,6 +925,7 @@ boolean         LoadTheGame(FILE *file,int x,int y);
 boolean         SaveTheGame(FILE *file,int x,int y);
 void            ShowViewSize (int width);
 void            ShutdownId (void);
+void            TraceFirstMenu (void);
 
 
 /*
@@ -934,7 +950,13 @@ void    DrawPlayBorderSides (void);
 void    ShowActStatus();
 
 void    PlayDemo (int demonumber);
+void    PlayDemoFile (const char *filename);
+void    TimeDemo (int demonumber);
+void    TimeDemoFrame (void);
 void    RecordDemo (void);
+void    RecordDemoFile (const char *filename, int level, int difficulty);
+void    RecordDemoFrame (byte buttonbits, int8_t x, int8_t y);
+void    FinishDemoRecord (void);
 
 
 #ifdef SPEAR
@@ -982,6 +1004,7 @@ extern  int             lastgamemusicoffset;
 extern  int         controlx,controly;              // range from -100 to 100
 extern  boolean     buttonstate[NUMBUTTONS];
 extern  objtype     objlist[MAXACTORS];
+extern  word        objgeneration[MAXACTORS];
 extern  boolean     buttonheld[NUMBUTTONS];
 extern  exit_t      playstate;
 extern  boolean     madenoise;
@@ -1059,6 +1082,51 @@ void PreloadGraphics(void);
 
 int DebugKeys (void);
 
+/*
+=============================================================================
+
+                                WL_PROF
+
+=============================================================================
+*/
+
+#ifdef ZONEPROFILER
+
+enum
+{
+   pz_frame,
+   pz_pollcontrols,
+   pz_movedoors,
+   pz_movepwalls,
+   pz_actors,
+   pz_paletteshifts,
+   pz_threedrefresh,
+   pz_clearscreen,
+   pz_wallrefresh,
+   pz_drawscaleds,
+   pz_drawweapon,
+   pz_updatescreen,
+   NUMPROFILEZONES
+};
+
+extern  char    *param_profile;
+
+void    InitProfile (void);
+void    ShutdownProfile (void);
+void    ProfileZone (int zone, uint64_t start);
+boolean WriteProfile (void);
+
+/* without --profile a zone costs only the test of param_profile */
+#define PROFILE_BEGIN(zone) uint64_t zone##_start = param_profile ? LR_GetPerformanceCounter() : 0
+#define PROFILE_END(zone)   do { if (param_profile) ProfileZone(zone, zone##_start); } while (0)
+
+#else
+
+#define PROFILE_BEGIN(zone)
+#define PROFILE_END(zone)
+
+#endif
+
 /*
 =============================================================================
 
@@ -1082,12 +1150,27 @@ extern  int32_t    frameon;
 extern  unsigned screenloc[3];
 
 extern  boolean fizzlein, fpscounter;
+extern  boolean interpolating, pipelining;
 
 extern  fixed   viewx,viewy;                    // the focal point
 extern  fixed   viewsin,viewcos;
 
 void    ThreeDRefresh (void);
+void    ViewBench (int frames);
 void    CalcTics (void);
+boolean TicElapsed (void);
+void    SaveInterpolation (void);
+void    SetupScaling (void);
+void    SetupHeightTable (void);
+void    InitRayThreads (void);
+void    ShutdownRayThreads (void);
+void    InitRenderThread (void);
+void    ShutdownRenderThread (void);
+boolean FinishRender (void);
+uint32_t SpriteCacheSize (void);
+void    ShutdownSpriteCache (void);
+void    SetupWallMips (void);
+void    ShutdownWallMips (void);
 
 typedef struct
 {
@@ -1192,6 +1275,7 @@ extern byte     pwalldir,pwalltile;
 void InitDoorList (void);
 void InitStaticList (void);
 void SpawnStatic (int tilex, int tiley, int type);
+void SpawnBenchStatics (int count);
 void SpawnDoor (int tilex, int tiley, boolean vertical, int lock);
 void MoveDoors (void);
 void MovePWalls (void);
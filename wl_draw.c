@@ -3,6 +3,10 @@
 #include "wl_def.h"
 #include "retro_endian.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /*
 =============================================================================
 
@@ -27,6 +31,18 @@
 static byte *vbuf = NULL;
 unsigned vbufPitch = 0;
 
+/* with --transposed the view is drawn into viewbuffer a column at a time
+ * (vbufPitch 1, vbufColumnPitch viewheight) and transposed afterwards */
+static unsigned vbufColumnPitch = 1;
+static byte *viewbuffer = NULL;
+
+#define FLOORCOLOR      0x19
+
+static byte ceilingcolor;
+
+/* bytes VGAClearScreen and the wall pass wrote into the view last frame */
+static uint32_t viewbyteswritten;
+
 int32_t    lasttimecount;
 int32_t    frameon;
 boolean fpscounter;
@@ -47,30 +63,84 @@ fixed   viewx,viewy; /* the focal point */
 short   viewangle;
 fixed   viewsin,viewcos;
 
-/* wall optimization variables */
-int     lastside;               /* true for vertical */
-int32_t    lastintercept;
-int     lasttilehit;
-int     lasttexture;
-
 /* ray tracing variables */
 short    focaltx,focalty,viewtx,viewty;
 longword xpartialup,xpartialdown,ypartialup,ypartialdown;
 
 short   midangle,angle;
 
-word    tilehit;
-int     pixx;
-
-short   xtile,ytile;
-short   xtilestep,ytilestep;
-int32_t    xintercept,yintercept;
-word    xstep,ystep;
-word    xspot,yspot;
-int     texdelta;
+/* everything a ray touches while it is cast, so that
+ * several strips of the view can be cast at once */
+typedef struct
+{
+   /* wall optimization variables */
+   int      lastside;           /* true for vertical */
+   int32_t  lastintercept;
+   int      lasttilehit;
+   int      lasttexture;
+
+   word     tilehit;
+   int      pixx;
+
+   short    xtile,ytile;
+   short    xtilestep,ytilestep;
+   int32_t  xintercept,yintercept;
+   word     xspot,yspot;
+   int      texdelta;
+
+   byte     *postsource;
+   int      postpage;           /* the page postsource is in */
+   int      postx;
+   int      postwidth;
+
+   int      min_wallheight;
+   int      startx,endx;        /* columns [startx,endx) of the strip */
+   uint32_t byteswritten;
+
+   /* the tiles this strip saw, marked in its own bitmap as strips run
+      in parallel; MergeVisTiles puts them into spotvis */
+   uint32_t seen[MAPSIZE*MAPSIZE/32];
+   int      numvistiles;
+   word     vistiles[MAPSIZE*MAPSIZE];
+} raycast_t;
 
 word horizwall[MAXWALLTILES],vertwall[MAXWALLTILES];
 
+/* the part of the game a frame is drawn from, see TakeSnapshot */
+typedef struct
+{
+   objtype   player;
+   int       weapon,weaponframe;
+   boolean   victoryflag;
+
+   byte      tilemap[MAPSIZE][MAPSIZE];
+   word      doorposition[MAXDOORS];
+   word      pwallpos,pwallx,pwally;
+   byte      pwalldir,pwalltile;
+
+   int       numstatics;
+   statobj_t statics[MAXSTATS];
+   short     statichead[MAPSIZE*MAPSIZE];   /* first static on a tile + 1 */
+   short     staticnext[MAXSTATS];          /* next static on its tile + 1 */
+
+   int       numactors;
+   objtype   actors[MAXACTORS];
+   objtype   *actorsource[MAXACTORS];
+   word      actorgeneration[MAXACTORS];   /* of the objlist slot */
+   boolean   actorseen[MAXACTORS];    /* activated by being in view */
+
+   int       numgrabbed;
+   short     grabbed[MAXSTATS];       /* bonus items the player reached */
+
+   boolean   feedback;                /* apply the above to the game */
+} snapshot_t;
+
+static snapshot_t snap;
+
+/* the spotvis entries set this frame, so clearing only touches those */
+static int  numvistiles;
+static word vistiles[MAPSIZE*MAPSIZE];
+
 
 /*
 ============================================================================
@@ -80,6 +150,61 @@ word horizwall[MAXWALLTILES],vertwall[MAXWALLTILES];
 ============================================================================
 */
 
+/*
+========================
+=
+= SetupHeightTable
+=
+= Fills heighttable with heightnumerator/d for every d = z>>8 a ray can
+= reach on the map, so CalcHeight and the transforms look the height up
+= instead of dividing.  Called by CalcProjection, like SetupScaling.
+=
+========================
+*/
+
+#define HEIGHTTABLESIZE ((2*MAPSIZE*TILEGLOBAL)>>8)
+
+static int32_t *heighttable;
+static int32_t  heighttablenumerator;
+
+void SetupHeightTable (void)
+{
+   int32_t d;
+
+   if(!heighttable)
+   {
+      heighttable = (int32_t *) malloc(HEIGHTTABLESIZE * sizeof(int32_t));
+      CHECKMALLOCRESULT(heighttable);
+   }
+   else if(heighttablenumerator == heightnumerator)
+      return;
+
+   heighttable[0] = 0;
+   for(d = 1; d < HEIGHTTABLESIZE; d++)
+      heighttable[d] = heightnumerator / d;
+
+   heighttablenumerator = heightnumerator;
+}
+
+/*
+========================
+=
+= HeightFromDist
+=
+= heightnumerator/(z>>8), z at least MINDIST
+=
+========================
+*/
+
+static inline int32_t HeightFromDist (fixed z)
+{
+   int32_t d = z >> 8;
+
+   if(d < HEIGHTTABLESIZE)
+      return heighttable[d];
+   return heightnumerator / d;
+}
+
 /*
 ========================
 =
@@ -135,7 +260,7 @@ static void TransformActor (objtype *ob)
    ob->viewx = (word)(centerx + ny*scale/nx);
 
    /* calculate height (heightnumerator/(nx>>8)) */
-   ob->viewheight = (word)(heightnumerator/(nx>>8));
+   ob->viewheight = (word)HeightFromDist(nx);
 }
 
 /*
@@ -185,7 +310,7 @@ static boolean TransformTile (int tx, int ty, short *dispx, short *dispheight)
    else
    {
       *dispx      = (short)(centerx + ny*scale/nx);
-      *dispheight = (short)(heightnumerator/(nx>>8));
+      *dispheight = (short)HeightFromDist(nx);
    }
 
    /* see if it should be grabbed */
@@ -204,18 +329,18 @@ static boolean TransformTile (int tx, int ty, short *dispx, short *dispheight)
 ====================
 */
 
-static int CalcHeight(void)
+static int CalcHeight(raycast_t *rc)
 {
    int height;
-   fixed z = FixedMul(xintercept - viewx, viewcos) - FixedMul(yintercept - viewy, viewsin);
+   fixed z = FixedMul(rc->xintercept - viewx, viewcos) - FixedMul(rc->yintercept - viewy, viewsin);
 
    if (z < MINDIST)
       z = MINDIST;
 
-   height = heightnumerator / (z >> 8);
+   height = HeightFromDist(z);
 
-   if(height < min_wallheight)
-      min_wallheight = height;
+   if(height < rc->min_wallheight)
+      rc->min_wallheight = height;
 
    return height;
 }
@@ -223,73 +348,336 @@ static int CalcHeight(void)
 /*
 ===================
 =
-= ScalePost
+= SetupScaling
+=
+= Builds the table ScalePost uses for each post height (wallheight>>3).
+= A post of height h covers 2*h rows centered on the view and steps
+= 32/h texels per row, starting from the bottom.  The table holds the
+= rows left after clipping to the view and the texel position at the
+= bottom row, so each post starts drawing right away.  The rows above
+= top are ceiling, the rows below bottom are floor.
+=
+= Called by CalcProjection, whenever viewheight or heightnumerator change
 =
 ===================
 */
 
-static byte *postsource;
-static int postx;
-static int postwidth;
+typedef struct
+{
+   int      top,bottom;         /* rows to draw, clipped to the view */
+   int      texel,frac;         /* texel at the bottom row plus frac/h */
+   int      step,stepfrac;      /* texels per row is step+stepfrac/h */
+} postscale_t;
+
+static postscale_t *postscale;
+static int          maxpostheight;
 
-static void ScalePost(void)
+void SetupScaling (void)
 {
-   int yoffs, yw, yd, yendoffs;
-   byte col;
-   int ywcount = yd = wallheight[postx] >> 3;
+   int h, skip;
+   postscale_t *ps;
+
+   /* CalcHeight never lets z get below MINDIST */
+   maxpostheight = (heightnumerator / (MINDIST >> 8)) >> 3;
+
+   free(postscale);
+   postscale = (postscale_t *) malloc((maxpostheight + 1) * sizeof(*postscale));
+   CHECKMALLOCRESULT(postscale);
+
+   /* a zero height post is all ceiling and floor */
+   postscale[0].top    = viewheight / 2;
+   postscale[0].bottom = viewheight / 2 - 1;
+
+   for(h = 1; h <= maxpostheight; h++)
+   {
+      ps         = &postscale[h];
+      ps->top    = viewheight / 2 - h;
+      ps->bottom = viewheight / 2 + h - 1;
+      skip       = 0;
+
+      if(ps->top < 0)
+         ps->top = 0;
 
-   if(yd <= 0)
-      yd      = 100;
+      if(ps->bottom >= viewheight)
+      {
+         skip       = ps->bottom - (viewheight - 1);
+         ps->bottom = viewheight - 1;
+      }
+
+      ps->texel    = TEXTURESIZE - 1 - (skip * (TEXTURESIZE/2)) / h;
+      ps->frac     = (skip * (TEXTURESIZE/2)) % h;
+      ps->step     = (TEXTURESIZE/2) / h;
+      ps->stepfrac = (TEXTURESIZE/2) % h;
+   }
+}
+
+/*
+=============================================================================
 
-   yoffs      = (viewheight / 2 - ywcount) * vbufPitch;
+                               WALL MIPMAPS
 
-   if (yoffs < 0)
-      yoffs   = 0;
+With --wallmips every wall and door page gets smaller copies of 32, 16
+and 8 texels per column.  A post that is drawn shorter than a copy is
+tall samples that copy, so a distant wall reads a few bytes per column
+instead of striding through the whole 64 byte column.  The filter mode
+averages each block of texels and takes the closest palette color, the
+nearest mode takes the texel in the middle of the block and keeps the
+look of the original.
+
+=============================================================================
+*/
+
+#define WALLMIPLEVELS   3
+#define WALLMIPSIZE     (32*32+16*16+8*8)
+
+static const int wallmipofs[WALLMIPLEVELS+1] = { 0, 0, 32*32, 32*32+16*16 };
+
+static byte *wallmips;
+
+/*
+===================
+=
+= WallMipColor
+=
+= The color of the size x size block of texels at x,y in page
+=
+===================
+*/
 
-   yoffs     += postx;
+static byte WallMipColor (byte *page, int x, int y, int size)
+{
+   int  i, j, r = 0, g = 0, b = 0, dist, best, bestdist;
+   byte col;
 
-   yendoffs   = viewheight / 2 + ywcount - 1;
-   yw         = TEXTURESIZE-1;
+   if(param_wallmips == WALLMIPS_NEAREST)
+      return page[(x + size/2) * TEXTURESIZE + y + size/2];
 
-   while(yendoffs >= viewheight)
+   for(i = 0; i < size; i++)
    {
-      ywcount -= TEXTURESIZE/2;
+      for(j = 0; j < size; j++)
+      {
+         col = page[(x + i) * TEXTURESIZE + y + j];
+         r  += gamepal[col].r;
+         g  += gamepal[col].g;
+         b  += gamepal[col].b;
+      }
+   }
+
+   r /= size * size;
+   g /= size * size;
+   b /= size * size;
 
-      while(ywcount <= 0)
+   best     = 0;
+   bestdist = 3*256*256;       /* more than any two colors are apart */
+   for(i = 0; i < 256; i++)
+   {
+      dist = (gamepal[i].r - r) * (gamepal[i].r - r)
+           + (gamepal[i].g - g) * (gamepal[i].g - g)
+           + (gamepal[i].b - b) * (gamepal[i].b - b);
+      if(dist < bestdist)
       {
-         ywcount += yd;
-         yw--;
+         bestdist = dist;
+         best     = i;
       }
-      yendoffs--;
    }
 
-   if(yw < 0)
+   return (byte) best;
+}
+
+/*
+===================
+=
+= SetupWallMips
+=
+= Builds the smaller copies of every wall page for --wallmips
+=
+===================
+*/
+
+void SetupWallMips (void)
+{
+   int  page, level, size, x, y;
+   byte *src, *dest;
+
+   if(param_wallmips == WALLMIPS_OFF || wallmips)
       return;
 
-   col      = postsource[yw];
-   yendoffs = yendoffs * vbufPitch + postx;
+   wallmips = (byte *) calloc(PMSpriteStart, WALLMIPSIZE);
+   CHECKMALLOCRESULT(wallmips);
+
+   for(page = 0; page < PMSpriteStart; page++)
+   {
+      /* sparse page */
+      if(PM_GetPageSize(page) < TEXTURESIZE*TEXTURESIZE)
+         continue;
+
+      src = PM_GetTexture(page);
+
+      for(level = 1; level <= WALLMIPLEVELS; level++)
+      {
+         size = 1 << level;
+         dest = wallmips + page * WALLMIPSIZE + wallmipofs[level];
+
+         for(x = 0; x < TEXTURESIZE; x += size)
+            for(y = 0; y < TEXTURESIZE; y += size)
+               *dest++ = WallMipColor(src, x, y, size);
+      }
+   }
+}
+
+/*
+===================
+=
+= ShutdownWallMips
+=
+===================
+*/
+
+void ShutdownWallMips (void)
+{
+   free(wallmips);
+   wallmips = NULL;
+}
+
+/*
+===================
+=
+= ScalePost
+=
+= In the transposed view every post is one contiguous row of viewbuffer,
+= so the ceiling and floor around it are filled here and each pixel of
+= the view is written once.  Row major views are cleared by
+= VGAClearScreen instead, filling a column at a time there is strided
+= and much slower than the extra row memsets.
+=
+===================
+*/
+
+static void ScalePost(raycast_t *rc)
+{
+   int x, y, h, texel, frac, shift;
+   byte *dest, *column;
+   postscale_t *ps;
+   byte *postsource = rc->postsource;
+   int width        = rc->postwidth;
+
+   h = wallheight[rc->postx] >> 3;
+   if(h < 0)
+      h = 0;
+   if(h > maxpostheight)
+      h = maxpostheight;
+
+   ps    = &postscale[h];
+
+   /* a post no taller than a mip level samples that level, texels
+    * still count in 64ths of the column and get shifted down */
+   for(shift = 0; wallmips && shift < WALLMIPLEVELS
+         && 2*h <= TEXTURESIZE >> (shift + 1); shift++);
+
+   if(shift)
+   {
+      x          = (int) (rc->postsource - PM_GetTexture(rc->postpage)) >> TEXTURESHIFT;
+      postsource = wallmips + rc->postpage * WALLMIPSIZE + wallmipofs[shift]
+         + (x >> shift) * (TEXTURESIZE >> shift);
+   }
+   dest  = vbuf + rc->postx * vbufColumnPitch;
+
+   if(vbufPitch == 1)
+   {
+      for(x = 0, column = dest; x < width; x++, column += vbufColumnPitch)
+      {
+         memset(column, ceilingcolor, ps->top);
+         memset(column + ps->bottom + 1, FLOORCOLOR, viewheight - 1 - ps->bottom);
+      }
+      rc->byteswritten += (viewheight - 1 - ps->bottom + ps->top) * width;
+   }
+   rc->byteswritten += (ps->bottom + 1 - ps->top) * width;
+
+   dest += ps->bottom * vbufPitch;
 
-   while(yoffs <= yendoffs)
+   /* a run of identical posts is filled a row at a time,
+    * unless the view is transposed and the posts are rows */
+   if(width > 1 && vbufColumnPitch == 1)
    {
-      vbuf[yendoffs]  = col;
-      ywcount        -= TEXTURESIZE/2;
+      texel = ps->texel;
+      frac  = ps->frac;
 
-      if (ywcount <= 0)
+      for(y = ps->bottom; y >= ps->top; y--)
       {
-         do
+         memset(dest, postsource[texel >> shift], width);
+         dest  -= vbufPitch;
+
+         texel -= ps->step;
+         frac  += ps->stepfrac;
+         if(frac >= h)
          {
-            ywcount += yd;
-            yw--;
-         }while(ywcount <= 0);
+            frac -= h;
+            texel--;
+         }
+      }
+      return;
+   }
 
-         if(yw < 0)
-            break;
-         col = postsource[yw];
+   for(x = 0; x < width; x++, dest += vbufColumnPitch)
+   {
+      column = dest;
+      texel  = ps->texel;
+      frac   = ps->frac;
+
+      for(y = ps->bottom; y >= ps->top; y--)
+      {
+         *column  = postsource[texel >> shift];
+         column  -= vbufPitch;
+
+         texel   -= ps->step;
+         frac    += ps->stepfrac;
+         if(frac >= h)
+         {
+            frac -= h;
+            texel--;
+         }
       }
-      yendoffs -= vbufPitch;
    }
 }
 
+/*
+====================
+=
+= ContinuePost
+=
+= The ray hit the same wall or door as the last one.  If it samples the
+= same texture column at the same post height the post just gets wider,
+= otherwise the finished post is drawn and a new one started
+=
+====================
+*/
+
+static void ContinuePost(raycast_t *rc, int texture)
+{
+   if((rc->pixx&3) && texture == rc->lasttexture)
+   {
+      wallheight[rc->pixx] = wallheight[rc->pixx-1];
+      rc->postwidth++;
+      return;
+   }
+
+   wallheight[rc->pixx] = CalcHeight(rc);
+
+   if(texture == rc->lasttexture
+         && wallheight[rc->pixx] >> 3 == wallheight[rc->postx] >> 3)
+   {
+      rc->postwidth++;
+      return;
+   }
+
+   ScalePost(rc);
+
+   rc->postsource      += texture-rc->lasttexture;
+   rc->postwidth        = 1;
+   rc->postx            = rc->pixx;
+   rc->lasttexture      = texture;
+}
+
 /*
 ====================
 =
@@ -301,61 +689,49 @@ static void ScalePost(void)
 ====================
 */
 
-static void HitVertWall (void)
+static void HitVertWall(raycast_t *rc)
 {
    int wallpic;
-   int texture = ((yintercept+texdelta)>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
+   int texture = ((rc->yintercept+rc->texdelta)>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
 
-   if (xtilestep == -1)
+   if (rc->xtilestep == -1)
    {
       texture = TEXTUREMASK-texture;
-      xintercept += TILEGLOBAL;
+      rc->xintercept += TILEGLOBAL;
    }
 
-   if (lastside == 1 && lastintercept==xtile && lasttilehit==tilehit && !(lasttilehit & 0x40))
+   if (rc->lastside == 1 && rc->lastintercept==rc->xtile && rc->lasttilehit==rc->tilehit && !(rc->lasttilehit & 0x40))
    {
-      ScalePost();
-
-      if((pixx&3) && texture == lasttexture)
-      {
-         postx = pixx;
-         wallheight[pixx] = wallheight[pixx-1];
-         return;
-      }
-
-      wallheight[pixx]    = CalcHeight();
-      postsource         += texture-lasttexture;
-      postwidth           = 1;
-      postx               = pixx;
-      lasttexture         = texture;
+      ContinuePost(rc, texture);
       return;
    }
 
-   if (lastside != -1)
-      ScalePost();
+   if (rc->lastside != -1)
+      ScalePost(rc);
 
-   lastside         = 1;
-   lastintercept    = xtile;
-   lasttilehit      = tilehit;
-   lasttexture      = texture;
-   wallheight[pixx] = CalcHeight();
-   postx            = pixx;
-   postwidth        = 1;
+   rc->lastside         = 1;
+   rc->lastintercept    = rc->xtile;
+   rc->lasttilehit      = rc->tilehit;
+   rc->lasttexture      = texture;
+   wallheight[rc->pixx] = CalcHeight(rc);
+   rc->postx            = rc->pixx;
+   rc->postwidth        = 1;
 
    /* check for adjacent doors */
-   if (tilehit & 0x40)
+   if (rc->tilehit & 0x40)
    {                                                               
-      ytile = (short)(yintercept>>TILESHIFT);
+      rc->ytile = (short)(rc->yintercept>>TILESHIFT);
 
-      if ( tilemap[xtile-xtilestep][ytile]&0x80 )
+      if ( snap.tilemap[rc->xtile-rc->xtilestep][rc->ytile]&0x80 )
          wallpic = DOORWALL+3;
       else
-         wallpic = vertwall[tilehit & ~0x40];
+         wallpic = vertwall[rc->tilehit & ~0x40];
    }
    else
-      wallpic = vertwall[tilehit];
+      wallpic = vertwall[rc->tilehit];
 
-   postsource = PM_GetTexture(wallpic) + texture;
+   rc->postpage   = wallpic;
+   rc->postsource = PM_GetTexture(wallpic) + texture;
 }
 
 
@@ -370,60 +746,50 @@ static void HitVertWall (void)
 ====================
 */
 
-static void HitHorizWall(void)
+static void HitHorizWall(raycast_t *rc)
 {
    int wallpic;
-   int texture = ((xintercept+texdelta)>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
+   int texture = ((rc->xintercept+rc->texdelta)>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
 
-   if (ytilestep == -1)
-      yintercept += TILEGLOBAL;
+   if (rc->ytilestep == -1)
+      rc->yintercept += TILEGLOBAL;
    else
       texture = TEXTUREMASK-texture;
 
-   if (lastside == 0 
-         && lastintercept == ytile
-         && lasttilehit   == tilehit
-         && !(lasttilehit & 0x40))
+   if (rc->lastside == 0 
+         && rc->lastintercept == rc->ytile
+         && rc->lasttilehit   == rc->tilehit
+         && !(rc->lasttilehit & 0x40))
    {
-      ScalePost();
-      if((pixx&3) && texture == lasttexture)
-      {
-         postx=pixx;
-         wallheight[pixx] = wallheight[pixx-1];
-         return;
-      }
-      wallheight[pixx]    = CalcHeight();
-      postsource         += texture-lasttexture;
-      postwidth           = 1;
-      postx               = pixx;
-      lasttexture         = texture;
+      ContinuePost(rc, texture);
       return;
    }
 
-   if (lastside != -1)
-      ScalePost();
+   if (rc->lastside != -1)
+      ScalePost(rc);
 
-   lastside               = 0;
-   lastintercept          = ytile;
-   lasttilehit            = tilehit;
-   lasttexture            = texture;
-   wallheight[pixx]       = CalcHeight();
-   postx                  = pixx;
-   postwidth              = 1;
+   rc->lastside               = 0;
+   rc->lastintercept          = rc->ytile;
+   rc->lasttilehit            = rc->tilehit;
+   rc->lasttexture            = texture;
+   wallheight[rc->pixx]       = CalcHeight(rc);
+   rc->postx                  = rc->pixx;
+   rc->postwidth              = 1;
 
    /* check for adjacent doors */
-   if (tilehit & 0x40)
+   if (rc->tilehit & 0x40)
    {
-      xtile = (short)(xintercept>>TILESHIFT);
-      if ( tilemap[xtile][ytile-ytilestep]&0x80)
+      rc->xtile = (short)(rc->xintercept>>TILESHIFT);
+      if ( snap.tilemap[rc->xtile][rc->ytile-rc->ytilestep]&0x80)
          wallpic = DOORWALL+2;
       else
-         wallpic = horizwall[tilehit & ~0x40];
+         wallpic = horizwall[rc->tilehit & ~0x40];
    }
    else
-      wallpic = horizwall[tilehit];
+      wallpic = horizwall[rc->tilehit];
 
-   postsource = PM_GetTexture(wallpic) + texture;
+   rc->postpage   = wallpic;
+   rc->postsource = PM_GetTexture(wallpic) + texture;
 }
 
 /*
@@ -434,38 +800,27 @@ static void HitHorizWall(void)
 ====================
 */
 
-static void HitHorizDoor (void)
+static void HitHorizDoor(raycast_t *rc)
 {
    int doorpage;
-   int doornum = tilehit&0x7f;
-   int texture = ((xintercept-doorposition[doornum])>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
+   int doornum = rc->tilehit&0x7f;
+   int texture = ((rc->xintercept-snap.doorposition[doornum])>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
 
-   if(lasttilehit==tilehit)
+   if(rc->lasttilehit==rc->tilehit)
    {
-      ScalePost();
-      if((pixx&3) && texture == lasttexture)
-      {
-         postx            = pixx;
-         wallheight[pixx] = wallheight[pixx-1];
-         return;
-      }
-      wallheight[pixx]  = CalcHeight();
-      postsource       += texture-lasttexture;
-      postwidth         = 1;
-      postx             = pixx;
-      lasttexture       = texture;
+      ContinuePost(rc, texture);
       return;
    }
 
-   if (lastside != -1)
-      ScalePost();
+   if (rc->lastside != -1)
+      ScalePost(rc);
 
-   lastside         = 2;
-   lasttilehit      = tilehit;
-   lasttexture      = texture;
-   wallheight[pixx] = CalcHeight();
-   postx            = pixx;
-   postwidth        = 1;
+   rc->lastside         = 2;
+   rc->lasttilehit      = rc->tilehit;
+   rc->lasttexture      = texture;
+   wallheight[rc->pixx] = CalcHeight(rc);
+   rc->postx            = rc->pixx;
+   rc->postwidth        = 1;
 
    switch(doorobjlist[doornum].lock)
    {
@@ -483,7 +838,8 @@ static void HitHorizDoor (void)
          break;
    }
 
-   postsource = PM_GetTexture(doorpage) + texture;
+   rc->postpage   = doorpage;
+   rc->postsource = PM_GetTexture(doorpage) + texture;
 }
 
 /*
@@ -494,40 +850,27 @@ static void HitHorizDoor (void)
 ====================
 */
 
-static void HitVertDoor (void)
+static void HitVertDoor(raycast_t *rc)
 {
    int doorpage;
-   int doornum = tilehit&0x7f;
-   int texture = ((yintercept - doorposition[doornum]) >> TEXTUREFROMFIXEDSHIFT) & TEXTUREMASK;
+   int doornum = rc->tilehit&0x7f;
+   int texture = ((rc->yintercept - snap.doorposition[doornum]) >> TEXTUREFROMFIXEDSHIFT) & TEXTUREMASK;
 
-   if (lasttilehit == tilehit)
+   if (rc->lasttilehit == rc->tilehit)
    {
-      ScalePost();
-
-      if((pixx&3) && texture == lasttexture)
-      {
-         postx            = pixx;
-         wallheight[pixx] = wallheight[pixx-1];
-         return;
-      }
-
-      wallheight[pixx]    = CalcHeight();
-      postsource         += texture-lasttexture;
-      postwidth           = 1;
-      postx               = pixx;
-      lasttexture         = texture;
+      ContinuePost(rc, texture);
       return;
    }
 
-   if (lastside != -1)
-      ScalePost();
+   if (rc->lastside != -1)
+      ScalePost(rc);
 
-   lastside         = 2;
-   lasttilehit      = tilehit;
-   lasttexture      = texture;
-   wallheight[pixx] = CalcHeight();
-   postx            = pixx;
-   postwidth        = 1;
+   rc->lastside         = 2;
+   rc->lasttilehit      = rc->tilehit;
+   rc->lasttexture      = texture;
+   wallheight[rc->pixx] = CalcHeight(rc);
+   rc->postx            = rc->pixx;
+   rc->postwidth        = 1;
 
    switch(doorobjlist[doornum].lock)
    {
@@ -545,50 +888,57 @@ static void HitVertDoor (void)
          break;
    }
 
-   postsource = PM_GetTexture(doorpage) + texture;
+   rc->postpage   = doorpage;
+   rc->postsource = PM_GetTexture(doorpage) + texture;
 }
 
 //==========================================================================
 
-byte vgaCeiling[]=
-{
-#ifndef SPEAR
- 0x1d,0x1d,0x1d,0x1d,0x1d,0x1d,0x1d,0x1d,0x1d,0xbf,
- 0x4e,0x4e,0x4e,0x1d,0x8d,0x4e,0x1d,0x2d,0x1d,0x8d,
- 0x1d,0x1d,0x1d,0x1d,0x1d,0x2d,0xdd,0x1d,0x1d,0x98,
-
- 0x1d,0x9d,0x2d,0xdd,0xdd,0x9d,0x2d,0x4d,0x1d,0xdd,
- 0x7d,0x1d,0x2d,0x2d,0xdd,0xd7,0x1d,0x1d,0x1d,0x2d,
- 0x1d,0x1d,0x1d,0x1d,0xdd,0xdd,0x7d,0xdd,0xdd,0xdd
-#else
- 0x6f,0x4f,0x1d,0xde,0xdf,0x2e,0x7f,0x9e,0xae,0x7f,
- 0x1d,0xde,0xdf,0xde,0xdf,0xde,0xe1,0xdc,0x2e,0x1d,0xdc
-#endif
-};
-
 /*
 =====================
 =
 = VGAClearScreen
 =
+= Fills a row major view with ceiling and floor, ScalePost does it for
+= the transposed view
+=
 =====================
 */
 
 static void VGAClearScreen (void)
 {
    int y;
-   byte ceiling = vgaCeiling[gamestate.episode*10+mapon];
-   byte *ptr    = vbuf;
+   byte *ptr = vbuf;
 
    for(y = 0; y < viewheight / 2; y++, ptr += vbufPitch)
-      memset(ptr, ceiling, viewwidth);
+      memset(ptr, ceilingcolor, viewwidth);
 
    for(; y < viewheight; y++, ptr += vbufPitch)
-      memset(ptr, 0x19, viewwidth);
+      memset(ptr, FLOORCOLOR, viewwidth);
+
+   viewbyteswritten += viewwidth * viewheight;
 }
 
 //==========================================================================
 
+byte vgaCeiling[]=
+{
+#ifndef SPEAR
+ 0x1d,0x1d,0x1d,0x1d,0x1d,0x1d,0x1d,0x1d,0x1d,0xbf,
+ 0x4e,0x4e,0x4e,0x1d,0x8d,0x4e,0x1d,0x2d,0x1d,0x8d,
+ 0x1d,0x1d,0x1d,0x1d,0x1d,0x2d,0xdd,0x1d,0x1d,0x98,
+
+ 0x1d,0x9d,0x2d,0xdd,0xdd,0x9d,0x2d,0x4d,0x1d,0xdd,
+ 0x7d,0x1d,0x2d,0x2d,0xdd,0xd7,0x1d,0x1d,0x1d,0x2d,
+ 0x1d,0x1d,0x1d,0x1d,0xdd,0xdd,0x7d,0xdd,0xdd,0xdd
+#else
+ 0x6f,0x4f,0x1d,0xde,0xdf,0x2e,0x7f,0x9e,0xae,0x7f,
+ 0x1d,0xde,0xdf,0xde,0xdf,0xde,0xe1,0xdc,0x2e,0x1d,0xdc
+#endif
+};
+
+//==========================================================================
+
 /*
 =====================
 =
@@ -605,7 +955,7 @@ static int CalcRotate (objtype *ob)
     * vary by a trig value, but it is close 
     * enough with only eight rotations. */
 
-   int viewangle = player->angle + (centerx - ob->viewx)/8;
+   int viewangle = snap.player.angle + (centerx - ob->viewx)/8;
 
    if (ob->obclass == rocketobj || ob->obclass == hrocketobj)
       angle = (viewangle-180) - ob->angle;
@@ -625,39 +975,300 @@ static int CalcRotate (objtype *ob)
    return angle/(ANGLES/8);
 }
 
-static void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t flags)
-{
-   unsigned scale, pixheight;
-   unsigned starty,endy;
-   word *cmdptr;
-   byte *cline;
-   byte *line;
-   byte *vmem;
-   int actx,i,upperedge;
-   short newstart;
-   int scrstarty,screndy,lpix,rpix,pixcnt,ycnt;
-   unsigned j;
-   byte col;
-   t_compshape *shape = (t_compshape *) PM_GetSprite(shapenum);
-   word leftpix       = (word)Retro_SwapLES16(shape->leftpix);
-   word rightpix      = (word)Retro_SwapLES16(shape->rightpix);
-   scale              = height >> 3; /* low three bits are fractional */
+/*
+=============================================================================
 
-   /* too close or far away? */
-   if(!scale)
-      return;   
+                               SPRITE SPAN CACHE
 
-   pixheight          = scale * SPRITESCALEFACTOR;
-   actx               = xcenter-scale;
-   upperedge          = viewheight/2-scale;
+The first time a sprite is drawn its post commands are decoded into a
+native endian list of spans per source column, so the scalers don't have
+to parse the compressed shape for every screen column of every frame.
 
-   cmdptr             = (word *)shape->dataofs;
+=============================================================================
+*/
 
-   for(i= leftpix, pixcnt= i * pixheight, rpix = (pixcnt >> 6) + actx;
-         i <= rightpix;
-         i++, cmdptr++)
-   {
-      lpix=rpix;
+typedef struct
+{
+   word     starty,endy;        /* source rows [starty,endy) */
+   byte     *texels;            /* texels[j] is the texel of row j */
+} spritespan_t;
+
+typedef struct
+{
+   word         leftpix,rightpix;
+   word         *column;        /* column[i]..column[i+1] are the spans of leftpix+i */
+   spritespan_t *spans;
+} spritecache_t;
+
+static spritecache_t **spritecache;
+static int      numspritecache;
+static uint32_t spritecachesize;
+
+/*
+====================
+=
+= CacheSprite
+=
+====================
+*/
+
+static spritecache_t *CacheSprite (int shapenum)
+{
+   int i, numcols, numspans;
+   byte *line;
+   word *cmdptr;
+   spritecache_t *cache;
+   spritespan_t  *span;
+   t_compshape *shape = (t_compshape *) PM_GetSprite(shapenum);
+   word leftpix       = (word)Retro_SwapLES16(shape->leftpix);
+   word rightpix      = (word)Retro_SwapLES16(shape->rightpix);
+
+   numcols  = rightpix >= leftpix ? rightpix - leftpix + 1 : 0;
+   numspans = 0;
+
+   for(i = 0, cmdptr = shape->dataofs; i < numcols; i++, cmdptr++)
+   {
+      line = (byte *)shape + (word)Retro_SwapLES16(*cmdptr);
+      while(READWORD(&line) != 0)
+      {
+         line += 4;
+         numspans++;
+      }
+   }
+
+   /* one block holds the header, the column index and the spans */
+   spritecachesize += sizeof(*cache) + (numcols + 1) * sizeof(word) + numspans * sizeof(*span);
+   cache            = (spritecache_t *) malloc(sizeof(*cache) + numspans * sizeof(*span)
+         + (numcols + 1) * sizeof(word));
+   CHECKMALLOCRESULT(cache);
+
+   cache->leftpix   = leftpix;
+   cache->rightpix  = rightpix;
+   cache->spans     = (spritespan_t *) (cache + 1);
+   cache->column    = (word *) (cache->spans + numspans);
+
+   span = cache->spans;
+   for(i = 0, cmdptr = shape->dataofs; i < numcols; i++, cmdptr++)
+   {
+      word endy;
+
+      cache->column[i] = (word) (span - cache->spans);
+      line = (byte *)shape + (word)Retro_SwapLES16(*cmdptr);
+
+      while((endy = READWORD(&line)) != 0)
+      {
+         short newstart = READWORD(&line);
+
+         span->endy     = endy >> 1;
+         span->texels   = (byte *)shape + newstart;
+         span->starty   = READWORD(&line) >> 1;
+         span++;
+      }
+   }
+   cache->column[numcols] = (word) (span - cache->spans);
+
+   spritecache[shapenum] = cache;
+   return cache;
+}
+
+static inline spritecache_t *GetSpriteCache (int shapenum)
+{
+   if(!spritecache)
+   {
+      numspritecache = PMSoundStart - PMSpriteStart;
+      spritecache    = (spritecache_t **) calloc(numspritecache, sizeof(*spritecache));
+      CHECKMALLOCRESULT(spritecache);
+      spritecachesize = numspritecache * sizeof(*spritecache);
+   }
+
+   if(spritecache[shapenum])
+      return spritecache[shapenum];
+   return CacheSprite(shapenum);
+}
+
+/*
+====================
+=
+= SpriteCacheSize
+=
+= Bytes used by the sprite span cache so far
+=
+====================
+*/
+
+uint32_t SpriteCacheSize (void)
+{
+   return spritecachesize;
+}
+
+/*
+====================
+=
+= ShutdownSpriteCache
+=
+====================
+*/
+
+void ShutdownSpriteCache (void)
+{
+   int i;
+
+   if(!spritecache)
+      return;
+
+   for(i = 0; i < numspritecache; i++)
+      free(spritecache[i]);
+   free(spritecache);
+
+   spritecache     = NULL;
+   numspritecache  = 0;
+   spritecachesize = 0;
+}
+
+/*
+=============================================================================
+
+                            SPRITE OCCLUSION
+
+A sprite column shows where the wall in front of it is lower than the
+sprite, wallheight[x] <= height.  After WallRefresh, BuildWallMin sums
+wallheight[] up into levels where level k holds the lowest wall over
+each run of 2^k columns.  NextVisibleColumn walks those levels, so
+ScaleShape can reject a sprite hidden behind walls, and skip the hidden
+columns of a visible one, without testing every column.
+
+=============================================================================
+*/
+
+#define MAXWALLMINLEVELS 16
+
+static int *wallmin;
+static int *wallminlevel[MAXWALLMINLEVELS];
+static int  wallminlen[MAXWALLMINLEVELS];
+static int  wallminlevels;
+
+/*
+====================
+=
+= BuildWallMin
+=
+====================
+*/
+
+static void BuildWallMin (void)
+{
+   int k,j,n;
+   int *src,*dest;
+
+   if(!wallmin)
+   {
+      /* each level is rounded up, so together they may exceed viewwidth,
+         but never 2 * viewwidth */
+      wallmin = (int *) malloc(2 * screenWidth * sizeof(int));
+      CHECKMALLOCRESULT(wallmin);
+   }
+
+   wallminlevel[0] = wallheight;
+   wallminlen[0]   = viewwidth;
+   dest            = wallmin;
+
+   for(k = 1; wallminlen[k-1] > 1; k++)
+   {
+      src = wallminlevel[k-1];
+      n   = wallminlen[k-1];
+
+      wallminlevel[k] = dest;
+      wallminlen[k]   = (n + 1) >> 1;
+
+      for(j = 0; j < n >> 1; j++)
+         dest[j] = src[2*j] < src[2*j+1] ? src[2*j] : src[2*j+1];
+      if(n & 1)
+         dest[j] = src[n-1];
+
+      dest += wallminlen[k];
+   }
+
+   wallminlevels = k;
+}
+
+/*
+====================
+=
+= NextVisibleColumn
+=
+= Returns the first column from x on where a sprite of the given height
+= shows, or viewwidth if there is none
+=
+====================
+*/
+
+static int NextVisibleColumn (int x, int height)
+{
+   int k = 0, p = x;
+
+   /* climb while the run p starts is hidden */
+   for(;;)
+   {
+      if(p >= wallminlen[k])
+         return viewwidth;
+      if(wallminlevel[k][p] <= height)
+         break;
+
+      p++;
+      if(!(p & 1) && k < wallminlevels - 1)
+      {
+         p >>= 1;
+         k++;
+      }
+   }
+
+   /* and come down on its first visible column */
+   while(k > 0)
+   {
+      k--;
+      p <<= 1;
+      if(wallminlevel[k][p] > height)
+         p++;
+   }
+
+   return p;
+}
+
+static void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t flags)
+{
+   unsigned scale, pixheight;
+   unsigned starty,endy;
+   spritespan_t *span,*spanstart,*spanend;
+   byte *texels;
+   byte *vmem;
+   int actx,i,upperedge,vis;
+   int scrstarty,screndy,lpix,rpix,pixcnt,ycnt;
+   unsigned j;
+   byte col;
+   spritecache_t *cache = GetSpriteCache(shapenum);
+   word leftpix         = cache->leftpix;
+   word rightpix        = cache->rightpix;
+   scale                = height >> 3; /* low three bits are fractional */
+
+   /* too close or far away? */
+   if(!scale)
+      return;   
+
+   pixheight          = scale * SPRITESCALEFACTOR;
+   actx               = xcenter-scale;
+   upperedge          = viewheight/2-scale;
+
+   /* entirely behind walls? */
+   lpix = (int) ((leftpix * pixheight) >> 6) + actx;
+   rpix = (int) (((rightpix + 1) * pixheight) >> 6) + actx;
+   if(NextVisibleColumn(lpix < 0 ? 0 : lpix, height) >= rpix)
+      return;
+
+   for(i= leftpix, pixcnt= i * pixheight, rpix = (pixcnt >> 6) + actx;
+         i <= rightpix;
+         i++)
+   {
+      lpix=rpix;
 
       if(lpix >= viewwidth)
          break;
@@ -670,29 +1281,42 @@ static void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t fla
          if(lpix < 0)
             lpix=0;
 
+         /* hidden? then go on with the column where it shows again */
+         vis = NextVisibleColumn(lpix, height);
+         if(vis >= rpix)
+         {
+            if(vis >= viewwidth)
+               break;
+            i      = ((((vis - actx + 1) << 6) + pixheight - 1) / pixheight) - 1;
+            pixcnt = i * pixheight;
+            rpix   = (pixcnt >> 6) + actx;
+            i--;
+            continue;
+         }
+         lpix = vis;
+
+         spanstart = cache->spans + cache->column[i - leftpix];
+         spanend   = cache->spans + cache->column[i - leftpix + 1];
+
          if(rpix > viewwidth)
             rpix= viewwidth, i = rightpix + 1;
 
-         cline = (byte *)shape + (word)Retro_SwapLES16(*cmdptr);
-
          while(lpix < rpix)
          {
             if(wallheight[lpix] <= (int)height)
             {
-               line = cline;
-
-               while((endy = READWORD(&line)) != 0)
+               for(span = spanstart; span < spanend; span++)
                {
-                  endy     >>= 1;
-                  newstart   = READWORD(&line);
-                  starty     = READWORD(&line) >> 1;
+                  starty     = span->starty;
+                  endy       = span->endy;
+                  texels     = span->texels;
                   ycnt       = starty * pixheight;
                   screndy    = (ycnt >> 6) + upperedge;
 
                   if(screndy<0)
-                     vmem    = vbuf+lpix;
+                     vmem    = vbuf + lpix * vbufColumnPitch;
                   else
-                     vmem    = vbuf + screndy * vbufPitch + lpix;
+                     vmem    = vbuf + screndy * vbufPitch + lpix * vbufColumnPitch;
 
                   for(j = starty; j < endy; j++)
                   {
@@ -702,7 +1326,7 @@ static void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t fla
 
                      if(scrstarty != screndy && screndy > 0)
                      {
-                        col=((byte *)shape)[newstart+j];
+                        col=texels[j];
 
                         if(scrstarty < 0)
                            scrstarty=0;
@@ -729,26 +1353,24 @@ static void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t fla
 static void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
 {
    unsigned starty,endy;
-   byte *cline;
-   byte *line;
+   spritespan_t *span,*spanstart,*spanend;
+   byte *texels;
    int i;
-   short newstart;
    int scrstarty,screndy,lpix,rpix,pixcnt,ycnt;
    unsigned j;
    byte col;
    byte *vmem;
-   t_compshape *shape = (t_compshape *) PM_GetSprite(shapenum);
-   word leftpix       = (word)Retro_SwapLES16(shape->leftpix);
-   word rightpix      = (word)Retro_SwapLES16(shape->rightpix);
-   unsigned scale     = height >> 1;
-   unsigned pixheight = scale * SPRITESCALEFACTOR;
-   int actx           = xcenter - scale;
-   int upperedge      = viewheight / 2 - scale;
-   word *cmdptr       = shape->dataofs;
+   spritecache_t *cache = GetSpriteCache(shapenum);
+   word leftpix         = cache->leftpix;
+   word rightpix        = cache->rightpix;
+   unsigned scale       = height >> 1;
+   unsigned pixheight   = scale * SPRITESCALEFACTOR;
+   int actx             = xcenter - scale;
+   int upperedge        = viewheight / 2 - scale;
 
    for(i = leftpix, pixcnt = i * pixheight, rpix = (pixcnt >> 6) + actx;
          i <= rightpix;
-         i++, cmdptr++)
+         i++)
    {
       lpix      = rpix;
 
@@ -765,26 +1387,27 @@ static void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
 
       if(lpix < 0)
          lpix = 0;
+
+      spanstart = cache->spans + cache->column[i - leftpix];
+      spanend   = cache->spans + cache->column[i - leftpix + 1];
+
       if(rpix > viewwidth)
          rpix = viewwidth, i = rightpix + 1;
-      cline   = (byte *)shape + (word)Retro_SwapLES16(*cmdptr);
 
       while(lpix < rpix)
       {
-         line=cline;
-
-         while((endy = READWORD(&line)) != 0)
+         for(span = spanstart; span < spanend; span++)
          {
-            endy     >>= 1;
-            newstart   = READWORD(&line);
-            starty     = READWORD(&line) >> 1;
+            starty     = span->starty;
+            endy       = span->endy;
+            texels     = span->texels;
             ycnt       = starty * pixheight;
             screndy    = (ycnt>>6)+upperedge;
 
             if(screndy<0)
-               vmem    = vbuf+lpix;
+               vmem    = vbuf+lpix*vbufColumnPitch;
             else
-               vmem    = vbuf+screndy*vbufPitch+lpix;
+               vmem    = vbuf+screndy*vbufPitch+lpix*vbufColumnPitch;
 
             for(j = starty; j < endy; j++)
             {
@@ -794,7 +1417,7 @@ static void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
 
                if(scrstarty != screndy && screndy > 0)
                {
-                  col = ((byte *)shape)[newstart+j];
+                  col = texels[j];
 
                   if (scrstarty < 0)
                      scrstarty = 0;
@@ -827,7 +1450,66 @@ typedef struct
 } visobj_t;
 
 visobj_t vislist[MAXVISABLE];
-visobj_t *visptr,*visstep,*farthest;
+visobj_t *visptr;
+
+static visobj_t *vissorted[MAXVISABLE],*visradix[MAXVISABLE];
+
+static uint64_t benchsorttime;
+
+/*
+=====================
+=
+= SortVisList
+=
+= Stable radix sort of vislist on viewheight, one pass per byte, so the
+= objects come out farthest first and equal heights keep their order
+=
+=====================
+*/
+
+static void SortVisList (int numvisable)
+{
+   int i,sum,count[256];
+
+   memset(count,0,sizeof(count));
+   for (i = 0; i < numvisable; i++)
+      count[(word)vislist[i].viewheight & 0xff]++;
+   for (i = 0, sum = 0; i < 256; i++)
+      sum += count[i], count[i] = sum - count[i];
+   for (i = 0; i < numvisable; i++)
+      visradix[count[(word)vislist[i].viewheight & 0xff]++] = &vislist[i];
+
+   memset(count,0,sizeof(count));
+   for (i = 0; i < numvisable; i++)
+      count[(word)visradix[i]->viewheight >> 8]++;
+   for (i = 0, sum = 0; i < 256; i++)
+      sum += count[i], count[i] = sum - count[i];
+   for (i = 0; i < numvisable; i++)
+      vissorted[count[(word)visradix[i]->viewheight >> 8]++] = visradix[i];
+}
+
+/*
+=====================
+=
+= LowestBit
+=
+= Index of the lowest set bit in bits, which must not be 0
+=
+=====================
+*/
+
+static inline int LowestBit (uint32_t bits)
+{
+#ifdef __GNUC__
+   return __builtin_ctz(bits);
+#else
+   int i = 0;
+
+   while (!(bits & 1))
+      bits >>= 1, i++;
+   return i;
+#endif
+}
 
 /*
 =====================
@@ -841,33 +1523,52 @@ visobj_t *visptr,*visstep,*farthest;
 
 static void DrawScaleds (void)
 {
-   int      i,least,numvisable,height;
+   int      i,s,numvisable;
    byte     *tilespot,*visspot;
    unsigned spotloc;
+   uint32_t bits,visstatics[(MAXSTATS+31)/32];
    statobj_t *statptr;
    objtype   *obj;
 
    visptr = &vislist[0];
 
+   /* find the statics on visable tiles, then place them in list order */
+   memset(visstatics,0,sizeof(visstatics));
+   for (i = 0; i < numvistiles; i++)
+   {
+      for (s = snap.statichead[vistiles[i]]; s; s = snap.staticnext[s-1])
+         visstatics[(s-1)>>5] |= 1u << ((s-1)&31);
+   }
+
    /* place static objects */
-   for (statptr = &statobjlist[0] ; statptr !=laststatobj ; statptr++)
+   for (s = 0; s < (MAXSTATS+31)/32; s++)
+   for (bits = visstatics[s]; bits; bits &= bits - 1)
    {
+      i       = (s<<5) + LowestBit (bits);
+      statptr = &snap.statics[i];
+
       /* object has been deleted? */
       if ((visptr->shapenum = statptr->shapenum) == -1)
          continue; 
-      
-      /* not visable? */
-      if (!*statptr->visspot)
-         continue; 
 
       if (TransformTile (statptr->tilex,statptr->tiley,
-               &visptr->viewx,&visptr->viewheight) && statptr->flags & FL_BONUS)
+               &visptr->viewx,&visptr->viewheight) && statptr->flags & FL_BONUS
+            && snap.feedback)
       {
-         GetBonus (statptr);
+         /* the render thread leaves that to FinishSnapshot */
+         if (pipelining)
+            snap.grabbed[snap.numgrabbed++] = i;
+         else
+         {
+            GetBonus (&statobjlist[i]);
+            statptr->shapenum = statobjlist[i].shapenum;
+            snap.weapon       = gamestate.weapon;
+            snap.weaponframe  = gamestate.weaponframe;
 
-         /* object has been taken? */
-         if(statptr->shapenum == -1)
-            continue;
+            /* object has been taken? */
+            if(statptr->shapenum == -1)
+               continue;
+         }
       }
 
       /* too close to the object? */
@@ -883,15 +1584,17 @@ static void DrawScaleds (void)
    }
 
    /* place active objects */
-   for (obj = player->next;obj;obj=obj->next)
+   for (i = 0; i < snap.numactors; i++)
    {
+      obj = &snap.actors[i];
+
       /* no shape? */
       if ((visptr->shapenum = obj->state->shapenum)==0)
          continue;
 
       spotloc  = (obj->tilex<<mapshift)+obj->tiley;   // optimize: keep in struct?
       visspot  = &spotvis[0][0]+spotloc;
-      tilespot = &tilemap[0][0]+spotloc;
+      tilespot = &snap.tilemap[0][0]+spotloc;
 
       /* could be in any of the nine surrounding tiles */
       if (*visspot
@@ -904,7 +1607,7 @@ static void DrawScaleds (void)
             || ( *(visspot+64) && !*(tilespot+64) )
             || ( *(visspot+63) && !*(tilespot+63) ) )
       {
-         obj->active = ac_yes;
+         snap.actorseen[i] = true;
          TransformActor (obj);
 
          /* too close or far away? */
@@ -941,24 +1644,48 @@ static void DrawScaleds (void)
    if (!numvisable)
       return;                                                                 
 
-   for (i = 0; i < numvisable; i++)
+   if (param_spritebench)
    {
-      least = 32000;
-      for (visstep = &vislist[0]; visstep<visptr; visstep++)
-      {
-         height = visstep->viewheight;
-         if (height < least)
-         {
-            least = height;
-            farthest = visstep;
-         }
-      }
+      uint64_t start = LR_GetPerformanceCounter();
+      SortVisList (numvisable);
+      benchsorttime += LR_GetPerformanceCounter() - start;
+   }
+   else
+      SortVisList (numvisable);
+
+   for (i = 0; i < numvisable; i++)
+      ScaleShape(vissorted[i]->viewx, vissorted[i]->shapenum,
+            vissorted[i]->viewheight, vissorted[i]->flags);
+}
+
+/*
+=====================
+=
+= BenchScaleds
+=
+= DrawScaleds for --spritebench, printing the average cost every 128 frames
+=
+=====================
+*/
+
+static void BenchScaleds (void)
+{
+   static uint64_t drawtime;
+   static int      frames,visable;
+   uint64_t        start = LR_GetPerformanceCounter();
+
+   DrawScaleds();
 
-      /* draw farthest */
-      ScaleShape(farthest->viewx, farthest->shapenum,
-            farthest->viewheight, farthest->flags);
+   drawtime += LR_GetPerformanceCounter() - start;
+   visable  += (int) (visptr-&vislist[0]);
 
-      farthest->viewheight = 32000;
+   if (++frames == 128)
+   {
+      printf("spritebench: %d objects visible, sort %u us, sort+draw %u us per frame\n",
+            visable / frames, (unsigned) (benchsorttime / frames),
+            (unsigned) (drawtime / frames));
+      drawtime = benchsorttime = 0;
+      frames   = visable = 0;
    }
 }
 
@@ -980,19 +1707,19 @@ static void DrawPlayerWeapon (void)
     int shapenum;
 
 #ifndef SPEAR
-    if (gamestate.victoryflag)
+    if (snap.victoryflag)
     {
 #ifndef APOGEE_1_0
-        if (player->state == &s_deathcam && (GetTimeCount()&32) )
+        if (snap.player.state == &s_deathcam && (GetTimeCount()&32) )
             SimpleScaleShape(viewwidth/2,SPR_DEATHCAM,viewheight+1);
 #endif
         return;
     }
 #endif
 
-    if (gamestate.weapon != -1)
+    if (snap.weapon != -1)
     {
-        shapenum = weaponscale[gamestate.weapon]+gamestate.weaponframe;
+        shapenum = weaponscale[snap.weapon]+snap.weaponframe;
         SimpleScaleShape(viewwidth/2,shapenum,viewheight+1);
     }
 
@@ -1038,103 +1765,243 @@ void CalcTics (void)
       tics = MAXTICS;
 }
 
-static void AsmRefresh(void)
-{
-   int32_t xstep,ystep;
-   longword xpartial,ypartial;
-   boolean playerInPushwallBackTile = tilemap[focaltx][focalty] == 64;
+/*
+=============================================================================
 
-   for(pixx = 0; pixx < viewwidth; pixx++)
-   {
-      short angl = midangle+pixelangle[pixx];
-      if(angl < 0)
-         angl += FINEANGLES;
-      if(angl >= 3600)
-         angl -= FINEANGLES;
+                            FRAME INTERPOLATION
 
-      if(angl < 900)
-      {
-         xtilestep=1;
-         ytilestep=-1;
-         xstep=finetangent[900-1-angl];
-         ystep=-finetangent[angl];
-         xpartial=xpartialup;
-         ypartial=ypartialdown;
-      }
-      else if(angl < 1800)
-      {
-         xtilestep=-1;
-         ytilestep=-1;
-         xstep=-finetangent[angl-900];
-         ystep=-finetangent[1800-1-angl];
-         xpartial=xpartialdown;
-         ypartial=ypartialdown;
-      }
-      else if(angl < 2700)
-      {
-         xtilestep= -1;
-         ytilestep=  1;
-         xstep    = -finetangent[2700-1-angl];
-         ystep    = finetangent[angl-1800];
-         xpartial = xpartialdown;
+With --interpolate the game still thinks in whole 1/70 s tics, but PlayLoop
+keeps drawing frames while it waits for the next tic instead of sleeping.
+Each of those frames moves the player and the actors part of the way from
+where they stood before the last tic to where it left them, by how far
+the clock is into the current tic.  So the view trails the game by up to
+one tic, but it changes on every frame the display can show.
+
+Only the first frame after a tic feeds back into the game (see RENDER
+SNAPSHOT); the frames in between are only drawn, so pickups, wakeups and
+aiming do not depend on how many of them the display fits into a tic.
+
+Anything that moved a tile or more in one tic (an elevator, a reused actor
+slot) is drawn where it is.  Demos are recorded and played without it.
+
+=============================================================================
+*/
+
+boolean interpolating;
+
+static fixed    lerpx[MAXACTORS], lerpy[MAXACTORS];
+static short    lerpangle;
+static boolean  ticdrawn;              /* the frame of this tic was drawn */
+
+/*
+=====================
+=
+= TicElapsed
+=
+= True once a whole tic has passed since the last CalcTics
+=
+=====================
+*/
+
+boolean TicElapsed (void)
+{
+   return (int32_t) ((LR_GetTicks() * 7) / 100) > lasttimecount;
+}
+
+/*
+=====================
+=
+= SaveInterpolation
+=
+= Called before every tic with the positions to interpolate from
+=
+=====================
+*/
+
+void SaveInterpolation (void)
+{
+   objtype *obj;
+
+   for (obj = player; obj; obj = obj->next)
+   {
+      lerpx[obj - objlist] = obj->x;
+      lerpy[obj - objlist] = obj->y;
+   }
+   lerpangle = player->angle;
+   ticdrawn  = false;
+}
+
+/*
+=====================
+=
+= Interpolate
+=
+=====================
+*/
+
+static void Interpolate (objtype *ob, objtype *source, int32_t part)
+{
+   int i = source - objlist;
+
+   if (labs(ob->x - lerpx[i]) < TILEGLOBAL && labs(ob->y - lerpy[i]) < TILEGLOBAL)
+   {
+      ob->x = lerpx[i] + (ob->x - lerpx[i]) * part / 100;
+      ob->y = lerpy[i] + (ob->y - lerpy[i]) * part / 100;
+   }
+}
+
+/*
+=====================
+=
+= InterpolateSnapshot
+=
+= Moves everything in the snapshot to where it is drawn this frame
+=
+=====================
+*/
+
+static void InterpolateSnapshot (void)
+{
+   int32_t  part, delta;
+   int      i;
+
+   /* hundredths of a tic since the last one */
+   part = (int32_t) (LR_GetTicks() * 7) - lasttimecount * 100;
+   if (part < 0)
+      part = 0;
+   else if (part > 100)
+      part = 100;
+
+   for (i = 0; i < snap.numactors; i++)
+      Interpolate (&snap.actors[i], snap.actorsource[i], part);
+
+   Interpolate (&snap.player, player, part);
+
+   delta = snap.player.angle - lerpangle;
+   if (delta > ANGLES/2)
+      delta -= ANGLES;
+   else if (delta < -ANGLES/2)
+      delta += ANGLES;
+
+   snap.player.angle = (short) ((lerpangle + delta * part / 100 + ANGLES) % ANGLES);
+   snap.player.tilex = (word) (snap.player.x >> TILESHIFT);
+   snap.player.tiley = (word) (snap.player.y >> TILESHIFT);
+}
+
+/*
+====================
+=
+= MarkVisTile
+=
+====================
+*/
+
+static inline void MarkVisTile(raycast_t *rc, word spot)
+{
+   if(!(rc->seen[spot>>5] & (1u << (spot&31))))
+   {
+      rc->seen[spot>>5] |= 1u << (spot&31);
+      rc->vistiles[rc->numvistiles++] = spot;
+   }
+}
+
+static void AsmRefresh(raycast_t *rc)
+{
+   int32_t xstep,ystep;
+   longword xpartial,ypartial;
+   boolean playerInPushwallBackTile = snap.tilemap[focaltx][focalty] == 64;
+
+   for(rc->pixx = rc->startx; rc->pixx < rc->endx; rc->pixx++)
+   {
+      short angl = midangle+pixelangle[rc->pixx];
+      if(angl < 0)
+         angl += FINEANGLES;
+      if(angl >= 3600)
+         angl -= FINEANGLES;
+
+      if(angl < 900)
+      {
+         rc->xtilestep=1;
+         rc->ytilestep=-1;
+         xstep=finetangent[900-1-angl];
+         ystep=-finetangent[angl];
+         xpartial=xpartialup;
+         ypartial=ypartialdown;
+      }
+      else if(angl < 1800)
+      {
+         rc->xtilestep=-1;
+         rc->ytilestep=-1;
+         xstep=-finetangent[angl-900];
+         ystep=-finetangent[1800-1-angl];
+         xpartial=xpartialdown;
+         ypartial=ypartialdown;
+      }
+      else if(angl < 2700)
+      {
+         rc->xtilestep= -1;
+         rc->ytilestep=  1;
+         xstep    = -finetangent[2700-1-angl];
+         ystep    = finetangent[angl-1800];
+         xpartial = xpartialdown;
          ypartial = ypartialup;
       }
       else if(angl < 3600)
       {
-         xtilestep= 1;
-         ytilestep= 1;
+         rc->xtilestep= 1;
+         rc->ytilestep= 1;
          xstep    = finetangent[angl-2700];
          ystep    = finetangent[3600-1-angl];
          xpartial = xpartialup;
          ypartial = ypartialup;
       }
 
-      yintercept  = FixedMul(ystep,xpartial)+viewy;
-      xtile       = focaltx+xtilestep;
-      xspot       = (word)((xtile<<mapshift)+((uint32_t)yintercept>>16));
-      xintercept  = FixedMul(xstep,ypartial)+viewx;
-      ytile       = focalty+ytilestep;
-      yspot       = (word)((((uint32_t)xintercept>>16)<<mapshift)+ytile);
-      texdelta    = 0;
+      rc->yintercept  = FixedMul(ystep,xpartial)+viewy;
+      rc->xtile       = focaltx+rc->xtilestep;
+      rc->xspot       = (word)((rc->xtile<<mapshift)+((uint32_t)rc->yintercept>>16));
+      rc->xintercept  = FixedMul(xstep,ypartial)+viewx;
+      rc->ytile       = focalty+rc->ytilestep;
+      rc->yspot       = (word)((((uint32_t)rc->xintercept>>16)<<mapshift)+rc->ytile);
+      rc->texdelta    = 0;
 
       /* Special treatment when player is in back tile of pushwall */
       if(playerInPushwallBackTile)
       {
-         if(    pwalldir == di_east && xtilestep ==  1
-               || pwalldir == di_west && xtilestep == -1)
+         if(    snap.pwalldir == di_east && rc->xtilestep ==  1
+               || snap.pwalldir == di_west && rc->xtilestep == -1)
          {
-            int32_t yintbuf = yintercept - ((ystep * (64 - pwallpos)) >> 6);
+            int32_t yintbuf = rc->yintercept - ((ystep * (64 - snap.pwallpos)) >> 6);
 
             /* ray hits pushwall back? */
             if((yintbuf >> 16) == focalty)
             {
-               if(pwalldir == di_east)
-                  xintercept = (focaltx << TILESHIFT) + (pwallpos << 10);
+               if(snap.pwalldir == di_east)
+                  rc->xintercept = (focaltx << TILESHIFT) + (snap.pwallpos << 10);
                else
-                  xintercept = (focaltx << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
-               yintercept = yintbuf;
-               ytile = (short) (yintercept >> TILESHIFT);
-               tilehit = pwalltile;
-               HitVertWall();
+                  rc->xintercept = (focaltx << TILESHIFT) - TILEGLOBAL + ((64 - snap.pwallpos) << 10);
+               rc->yintercept = yintbuf;
+               rc->ytile = (short) (rc->yintercept >> TILESHIFT);
+               rc->tilehit = snap.pwalltile;
+               HitVertWall(rc);
                continue;
             }
          }
-         else if(pwalldir == di_south && ytilestep ==  1
-               ||  pwalldir == di_north && ytilestep == -1)
+         else if(snap.pwalldir == di_south && rc->ytilestep ==  1
+               ||  snap.pwalldir == di_north && rc->ytilestep == -1)
          {
-            int32_t xintbuf = xintercept - ((xstep * (64 - pwallpos)) >> 6);
+            int32_t xintbuf = rc->xintercept - ((xstep * (64 - snap.pwallpos)) >> 6);
 
             /* ray hits pushwall back? */
             if((xintbuf >> 16) == focaltx)
             {
-               xintercept = xintbuf;
-               if(pwalldir == di_south)
-                  yintercept = (focalty << TILESHIFT) + (pwallpos << 10);
+               rc->xintercept = xintbuf;
+               if(snap.pwalldir == di_south)
+                  rc->yintercept = (focalty << TILESHIFT) + (snap.pwallpos << 10);
                else
-                  yintercept = (focalty << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
-               xtile = (short) (xintercept >> TILESHIFT);
-               tilehit = pwalltile;
-               HitHorizWall();
+                  rc->yintercept = (focalty << TILESHIFT) - TILEGLOBAL + ((64 - snap.pwallpos) << 10);
+               rc->xtile = (short) (rc->xintercept >> TILESHIFT);
+               rc->tilehit = snap.pwalltile;
+               HitHorizWall(rc);
                continue;
             }
          }
@@ -1142,329 +2009,514 @@ static void AsmRefresh(void)
 
       do
       {
-         if(ytilestep==-1 && (yintercept>>16)<=ytile)
+         if(rc->ytilestep==-1 && (rc->yintercept>>16)<=rc->ytile)
             goto horizentry;
-         if(ytilestep==1 && (yintercept>>16)>=ytile)
+         if(rc->ytilestep==1 && (rc->yintercept>>16)>=rc->ytile)
             goto horizentry;
 vertentry:
-         if((uint32_t)yintercept>mapheight*65536-1 || (word)xtile>=mapwidth)
+         if((uint32_t)rc->yintercept>mapheight*65536-1 || (word)rc->xtile>=mapwidth)
          {
-            if (xtile<0)
-               xintercept=0, xtile=0;
-            else if(xtile>=mapwidth)
-               xintercept=mapwidth<<TILESHIFT, xtile=mapwidth-1;
+            if (rc->xtile<0)
+               rc->xintercept=0, rc->xtile=0;
+            else if(rc->xtile>=mapwidth)
+               rc->xintercept=mapwidth<<TILESHIFT, rc->xtile=mapwidth-1;
             else
-               xtile=(short) (xintercept >> TILESHIFT);
+               rc->xtile=(short) (rc->xintercept >> TILESHIFT);
 
-            if(yintercept<0)
-               yintercept=0, ytile=0;
-            else if(yintercept>=(mapheight<<TILESHIFT))
-               yintercept=mapheight<<TILESHIFT, ytile=mapheight-1;
+            if(rc->yintercept<0)
+               rc->yintercept=0, rc->ytile=0;
+            else if(rc->yintercept>=(mapheight<<TILESHIFT))
+               rc->yintercept=mapheight<<TILESHIFT, rc->ytile=mapheight-1;
 
-            yspot=0xffff;
-            tilehit=0;
-            HitHorizWall();
+            rc->yspot=0xffff;
+            rc->tilehit=0;
+            HitHorizWall(rc);
             break;
          }
 
-         if(xspot>=maparea)
+         if(rc->xspot>=maparea)
             break;
 
-         tilehit=((byte *)tilemap)[xspot];
+         rc->tilehit=((byte *)snap.tilemap)[rc->xspot];
 
-         if(tilehit)
+         if(rc->tilehit)
          {
-            if(tilehit & 0x80)
+            if(rc->tilehit & 0x80)
             {
-               int32_t yintbuf=yintercept+(ystep>>1);
-               if((yintbuf>>16)!=(yintercept>>16))
+               int32_t yintbuf=rc->yintercept+(ystep>>1);
+               if((yintbuf>>16)!=(rc->yintercept>>16))
                   goto passvert;
-               if((word)yintbuf<doorposition[tilehit&0x7f])
+               if((word)yintbuf<snap.doorposition[rc->tilehit&0x7f])
                   goto passvert;
-               yintercept=yintbuf;
-               xintercept=(xtile<<TILESHIFT)|0x8000;
-               ytile = (short) (yintercept >> TILESHIFT);
-               HitVertDoor();
+               rc->yintercept=yintbuf;
+               rc->xintercept=(rc->xtile<<TILESHIFT)|0x8000;
+               rc->ytile = (short) (rc->yintercept >> TILESHIFT);
+               HitVertDoor(rc);
             }
             else
             {
-               if(tilehit == 64)
+               if(rc->tilehit == 64)
                {
-                  if(pwalldir==di_west || pwalldir==di_east)
+                  if(snap.pwalldir==di_west || snap.pwalldir==di_east)
                   {
                      int32_t yintbuf;
-                     int pwallposnorm = pwallpos;
-                     int pwallposinv  = 64 - pwallpos;
+                     int pwallposnorm = snap.pwallpos;
+                     int pwallposinv  = 64 - snap.pwallpos;
 
-                     if(pwalldir == di_west)
+                     if(snap.pwalldir == di_west)
                      {
-                        pwallposnorm = 64 - pwallpos;
-                        pwallposinv = pwallpos;
+                        pwallposnorm = 64 - snap.pwallpos;
+                        pwallposinv = snap.pwallpos;
                      }
 
-                     if(pwalldir == di_east && xtile==pwallx && ((uint32_t)yintercept>>16)==pwally
-                           || pwalldir == di_west && !(xtile==pwallx && ((uint32_t)yintercept>>16)==pwally))
+                     if(snap.pwalldir == di_east && rc->xtile==snap.pwallx && ((uint32_t)rc->yintercept>>16)==snap.pwally
+                           || snap.pwalldir == di_west && !(rc->xtile==snap.pwallx && ((uint32_t)rc->yintercept>>16)==snap.pwally))
                      {
-                        yintbuf=yintercept+((ystep*pwallposnorm)>>6);
-                        if((yintbuf>>16) != (yintercept>>16))
+                        yintbuf=rc->yintercept+((ystep*pwallposnorm)>>6);
+                        if((yintbuf>>16) != (rc->yintercept>>16))
                            goto passvert;
 
-                        xintercept=(xtile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
+                        rc->xintercept=(rc->xtile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
                      }
                      else
                      {
-                        yintbuf=yintercept+((ystep*pwallposinv)>>6);
-                        if((yintbuf>>16)!=(yintercept>>16))
+                        yintbuf=rc->yintercept+((ystep*pwallposinv)>>6);
+                        if((yintbuf>>16)!=(rc->yintercept>>16))
                            goto passvert;
 
-                        xintercept=(xtile<<TILESHIFT)-(pwallposinv<<10);
+                        rc->xintercept=(rc->xtile<<TILESHIFT)-(pwallposinv<<10);
                      }
 
-                     yintercept=yintbuf;
-                     ytile = (short) (yintercept >> TILESHIFT);
-                     tilehit = pwalltile;
-                     HitVertWall();
+                     rc->yintercept=yintbuf;
+                     rc->ytile = (short) (rc->yintercept >> TILESHIFT);
+                     rc->tilehit = snap.pwalltile;
+                     HitVertWall(rc);
                   }
                   else
                   {
-                     int pwallposi = pwallpos;
+                     int pwallposi = snap.pwallpos;
 
-                     if(pwalldir == di_north)
-                        pwallposi = 64-pwallpos;
+                     if(snap.pwalldir == di_north)
+                        pwallposi = 64-snap.pwallpos;
 
-                     if(pwalldir==di_south && (word)yintercept<(pwallposi<<10)
-                           || pwalldir==di_north && (word)yintercept>(pwallposi<<10))
+                     if(snap.pwalldir==di_south && (word)rc->yintercept<(pwallposi<<10)
+                           || snap.pwalldir==di_north && (word)rc->yintercept>(pwallposi<<10))
                      {
-                        if(((uint32_t)yintercept>>16)==pwally && xtile==pwallx)
+                        if(((uint32_t)rc->yintercept>>16)==snap.pwally && rc->xtile==snap.pwallx)
                         {
-                           if(pwalldir==di_south && (int32_t)((word)yintercept)+ystep<(pwallposi<<10)
-                                 || pwalldir==di_north && (int32_t)((word)yintercept)+ystep>(pwallposi<<10))
+                           if(snap.pwalldir==di_south && (int32_t)((word)rc->yintercept)+ystep<(pwallposi<<10)
+                                 || snap.pwalldir==di_north && (int32_t)((word)rc->yintercept)+ystep>(pwallposi<<10))
                               goto passvert;
 
-                           if(pwalldir==di_south)
-                              yintercept=(yintercept&0xffff0000)+(pwallposi<<10);
+                           if(snap.pwalldir==di_south)
+                              rc->yintercept=(rc->yintercept&0xffff0000)+(pwallposi<<10);
                            else
-                              yintercept=(yintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
-                           xintercept=xintercept-((xstep*(64-pwallpos))>>6);
-                           xtile = (short) (xintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitHorizWall();
+                              rc->yintercept=(rc->yintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
+                           rc->xintercept=rc->xintercept-((xstep*(64-snap.pwallpos))>>6);
+                           rc->xtile = (short) (rc->xintercept >> TILESHIFT);
+                           rc->tilehit=snap.pwalltile;
+                           HitHorizWall(rc);
                         }
                         else
                         {
-                           texdelta = -(pwallposi<<10);
-                           xintercept=xtile<<TILESHIFT;
-                           ytile = (short) (yintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitVertWall();
+                           rc->texdelta = -(pwallposi<<10);
+                           rc->xintercept=rc->xtile<<TILESHIFT;
+                           rc->ytile = (short) (rc->yintercept >> TILESHIFT);
+                           rc->tilehit=snap.pwalltile;
+                           HitVertWall(rc);
                         }
                      }
                      else
                      {
-                        if(((uint32_t)yintercept>>16)==pwally && xtile==pwallx)
+                        if(((uint32_t)rc->yintercept>>16)==snap.pwally && rc->xtile==snap.pwallx)
                         {
-                           texdelta = -(pwallposi<<10);
-                           xintercept=xtile<<TILESHIFT;
-                           ytile = (short) (yintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitVertWall();
+                           rc->texdelta = -(pwallposi<<10);
+                           rc->xintercept=rc->xtile<<TILESHIFT;
+                           rc->ytile = (short) (rc->yintercept >> TILESHIFT);
+                           rc->tilehit=snap.pwalltile;
+                           HitVertWall(rc);
                         }
                         else
                         {
-                           if(pwalldir==di_south && (int32_t)((word)yintercept)+ystep>(pwallposi<<10)
-                                 || pwalldir==di_north && (int32_t)((word)yintercept)+ystep<(pwallposi<<10))
+                           if(snap.pwalldir==di_south && (int32_t)((word)rc->yintercept)+ystep>(pwallposi<<10)
+                                 || snap.pwalldir==di_north && (int32_t)((word)rc->yintercept)+ystep<(pwallposi<<10))
                               goto passvert;
 
-                           if(pwalldir==di_south)
-                              yintercept = (yintercept&0xffff0000)-((64-pwallpos)<<10);
+                           if(snap.pwalldir==di_south)
+                              rc->yintercept = (rc->yintercept&0xffff0000)-((64-snap.pwallpos)<<10);
                            else
-                              yintercept = (yintercept&0xffff0000)+((64-pwallpos)<<10);
-                           xintercept    =  xintercept-((xstep*pwallpos)>>6);
-                           xtile         = (short) (xintercept >> TILESHIFT);
-                           tilehit       = pwalltile;
-                           HitHorizWall();
+                              rc->yintercept = (rc->yintercept&0xffff0000)+((64-snap.pwallpos)<<10);
+                           rc->xintercept    =  rc->xintercept-((xstep*snap.pwallpos)>>6);
+                           rc->xtile         = (short) (rc->xintercept >> TILESHIFT);
+                           rc->tilehit       = snap.pwalltile;
+                           HitHorizWall(rc);
                         }
                      }
                   }
                }
                else
                {
-                  xintercept = xtile<<TILESHIFT;
-                  ytile      = (short) (yintercept >> TILESHIFT);
-                  HitVertWall();
+                  rc->xintercept = rc->xtile<<TILESHIFT;
+                  rc->ytile      = (short) (rc->yintercept >> TILESHIFT);
+                  HitVertWall(rc);
                }
             }
             break;
          }
 passvert:
-         *((byte *)spotvis+xspot)=1;
-         xtile+=xtilestep;
-         yintercept+=ystep;
-         xspot=(word)((xtile<<mapshift)+((uint32_t)yintercept>>16));
+         MarkVisTile(rc, rc->xspot);
+         rc->xtile+=rc->xtilestep;
+         rc->yintercept+=ystep;
+         rc->xspot=(word)((rc->xtile<<mapshift)+((uint32_t)rc->yintercept>>16));
       }while(1);
       continue;
 
       do
       {
-         if(xtilestep==-1 && (xintercept>>16)<=xtile)
+         if(rc->xtilestep==-1 && (rc->xintercept>>16)<=rc->xtile)
             goto vertentry;
-         if(xtilestep==1 && (xintercept>>16)>=xtile)
+         if(rc->xtilestep==1 && (rc->xintercept>>16)>=rc->xtile)
             goto vertentry;
 horizentry:
-         if((uint32_t)xintercept>mapwidth*65536-1 || (word)ytile>=mapheight)
+         if((uint32_t)rc->xintercept>mapwidth*65536-1 || (word)rc->ytile>=mapheight)
          {
-            if (ytile<0)
-               yintercept=0, ytile=0;
-            else if(ytile >= mapheight)
-               yintercept = mapheight<<TILESHIFT, ytile=mapheight-1;
+            if (rc->ytile<0)
+               rc->yintercept=0, rc->ytile=0;
+            else if(rc->ytile >= mapheight)
+               rc->yintercept = mapheight<<TILESHIFT, rc->ytile=mapheight-1;
             else
-               ytile=(short) (yintercept >> TILESHIFT);
-
-            if(xintercept<0)
-               xintercept=0, xtile=0;
-            else if(xintercept>=(mapwidth<<TILESHIFT))
-               xintercept=mapwidth<<TILESHIFT, xtile=mapwidth-1;
-            xspot=0xffff;
-            tilehit=0;
-            HitVertWall();
+               rc->ytile=(short) (rc->yintercept >> TILESHIFT);
+
+            if(rc->xintercept<0)
+               rc->xintercept=0, rc->xtile=0;
+            else if(rc->xintercept>=(mapwidth<<TILESHIFT))
+               rc->xintercept=mapwidth<<TILESHIFT, rc->xtile=mapwidth-1;
+            rc->xspot=0xffff;
+            rc->tilehit=0;
+            HitVertWall(rc);
             break;
          }
 
-         if(yspot>=maparea)
+         if(rc->yspot>=maparea)
             break;
-         tilehit=((byte *)tilemap)[yspot];
+         rc->tilehit=((byte *)snap.tilemap)[rc->yspot];
 
-         if(tilehit)
+         if(rc->tilehit)
          {
-            if(tilehit&0x80)
+            if(rc->tilehit&0x80)
             {
-               int32_t xintbuf=xintercept+(xstep>>1);
-               if((xintbuf>>16)!=(xintercept>>16))
+               int32_t xintbuf=rc->xintercept+(xstep>>1);
+               if((xintbuf>>16)!=(rc->xintercept>>16))
                   goto passhoriz;
-               if((word)xintbuf<doorposition[tilehit&0x7f])
+               if((word)xintbuf<snap.doorposition[rc->tilehit&0x7f])
                   goto passhoriz;
-               xintercept=xintbuf;
-               yintercept=(ytile<<TILESHIFT)+0x8000;
-               xtile = (short) (xintercept >> TILESHIFT);
-               HitHorizDoor();
+               rc->xintercept=xintbuf;
+               rc->yintercept=(rc->ytile<<TILESHIFT)+0x8000;
+               rc->xtile = (short) (rc->xintercept >> TILESHIFT);
+               HitHorizDoor(rc);
             }
             else
             {
-               if(tilehit==64)
+               if(rc->tilehit==64)
                {
-                  if(pwalldir==di_north || pwalldir==di_south)
+                  if(snap.pwalldir==di_north || snap.pwalldir==di_south)
                   {
                      int32_t xintbuf;
-                     int pwallposnorm = pwallpos;
-                     int pwallposinv  = 64 - pwallpos;
+                     int pwallposnorm = snap.pwallpos;
+                     int pwallposinv  = 64 - snap.pwallpos;
 
-                     if(pwalldir==di_north)
+                     if(snap.pwalldir==di_north)
                      {
-                        pwallposnorm = 64-pwallpos;
-                        pwallposinv = pwallpos;
+                        pwallposnorm = 64-snap.pwallpos;
+                        pwallposinv = snap.pwallpos;
                      }
 
-                     if(pwalldir == di_south && ytile==pwally && ((uint32_t)xintercept>>16)==pwallx
-                           || pwalldir == di_north && !(ytile==pwally && ((uint32_t)xintercept>>16)==pwallx))
+                     if(snap.pwalldir == di_south && rc->ytile==snap.pwally && ((uint32_t)rc->xintercept>>16)==snap.pwallx
+                           || snap.pwalldir == di_north && !(rc->ytile==snap.pwally && ((uint32_t)rc->xintercept>>16)==snap.pwallx))
                      {
-                        xintbuf=xintercept+((xstep*pwallposnorm)>>6);
-                        if((xintbuf>>16)!=(xintercept>>16))
+                        xintbuf=rc->xintercept+((xstep*pwallposnorm)>>6);
+                        if((xintbuf>>16)!=(rc->xintercept>>16))
                            goto passhoriz;
 
-                        yintercept=(ytile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
+                        rc->yintercept=(rc->ytile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
                      }
                      else
                      {
-                        xintbuf=xintercept+((xstep*pwallposinv)>>6);
-                        if((xintbuf>>16)!=(xintercept>>16))
+                        xintbuf=rc->xintercept+((xstep*pwallposinv)>>6);
+                        if((xintbuf>>16)!=(rc->xintercept>>16))
                            goto passhoriz;
 
-                        yintercept=(ytile<<TILESHIFT)-(pwallposinv<<10);
+                        rc->yintercept=(rc->ytile<<TILESHIFT)-(pwallposinv<<10);
                      }
 
-                     xintercept=xintbuf;
-                     xtile = (short) (xintercept >> TILESHIFT);
-                     tilehit=pwalltile;
-                     HitHorizWall();
+                     rc->xintercept=xintbuf;
+                     rc->xtile = (short) (rc->xintercept >> TILESHIFT);
+                     rc->tilehit=snap.pwalltile;
+                     HitHorizWall(rc);
                   }
                   else
                   {
-                     int pwallposi = pwallpos;
-                     if(pwalldir==di_west) pwallposi = 64-pwallpos;
-                     if(pwalldir==di_east && (word)xintercept<(pwallposi<<10)
-                           || pwalldir==di_west && (word)xintercept>(pwallposi<<10))
+                     int pwallposi = snap.pwallpos;
+                     if(snap.pwalldir==di_west) pwallposi = 64-snap.pwallpos;
+                     if(snap.pwalldir==di_east && (word)rc->xintercept<(pwallposi<<10)
+                           || snap.pwalldir==di_west && (word)rc->xintercept>(pwallposi<<10))
                      {
-                        if(((uint32_t)xintercept>>16)==pwallx && ytile==pwally)
+                        if(((uint32_t)rc->xintercept>>16)==snap.pwallx && rc->ytile==snap.pwally)
                         {
-                           if(pwalldir==di_east && (int32_t)((word)xintercept)+xstep<(pwallposi<<10)
-                                 || pwalldir==di_west && (int32_t)((word)xintercept)+xstep>(pwallposi<<10))
+                           if(snap.pwalldir==di_east && (int32_t)((word)rc->xintercept)+xstep<(pwallposi<<10)
+                                 || snap.pwalldir==di_west && (int32_t)((word)rc->xintercept)+xstep>(pwallposi<<10))
                               goto passhoriz;
 
-                           if(pwalldir==di_east)
-                              xintercept=(xintercept&0xffff0000)+(pwallposi<<10);
+                           if(snap.pwalldir==di_east)
+                              rc->xintercept=(rc->xintercept&0xffff0000)+(pwallposi<<10);
                            else
-                              xintercept=(xintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
-                           yintercept=yintercept-((ystep*(64-pwallpos))>>6);
-                           ytile = (short) (yintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitVertWall();
+                              rc->xintercept=(rc->xintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
+                           rc->yintercept=rc->yintercept-((ystep*(64-snap.pwallpos))>>6);
+                           rc->ytile = (short) (rc->yintercept >> TILESHIFT);
+                           rc->tilehit=snap.pwalltile;
+                           HitVertWall(rc);
                         }
                         else
                         {
-                           texdelta = -(pwallposi<<10);
-                           yintercept=ytile<<TILESHIFT;
-                           xtile = (short) (xintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitHorizWall();
+                           rc->texdelta = -(pwallposi<<10);
+                           rc->yintercept=rc->ytile<<TILESHIFT;
+                           rc->xtile = (short) (rc->xintercept >> TILESHIFT);
+                           rc->tilehit=snap.pwalltile;
+                           HitHorizWall(rc);
                         }
                      }
                      else
                      {
-                        if(((uint32_t)xintercept>>16)==pwallx && ytile==pwally)
+                        if(((uint32_t)rc->xintercept>>16)==snap.pwallx && rc->ytile==snap.pwally)
                         {
-                           texdelta = -(pwallposi<<10);
-                           yintercept=ytile<<TILESHIFT;
-                           xtile = (short) (xintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitHorizWall();
+                           rc->texdelta = -(pwallposi<<10);
+                           rc->yintercept=rc->ytile<<TILESHIFT;
+                           rc->xtile = (short) (rc->xintercept >> TILESHIFT);
+                           rc->tilehit=snap.pwalltile;
+                           HitHorizWall(rc);
                         }
                         else
                         {
-                           if(pwalldir==di_east && (int32_t)((word)xintercept)+xstep>(pwallposi<<10)
-                                 || pwalldir==di_west && (int32_t)((word)xintercept)+xstep<(pwallposi<<10))
+                           if(snap.pwalldir==di_east && (int32_t)((word)rc->xintercept)+xstep>(pwallposi<<10)
+                                 || snap.pwalldir==di_west && (int32_t)((word)rc->xintercept)+xstep<(pwallposi<<10))
                               goto passhoriz;
 
-                           if(pwalldir==di_east)
-                              xintercept=(xintercept&0xffff0000)-((64-pwallpos)<<10);
+                           if(snap.pwalldir==di_east)
+                              rc->xintercept=(rc->xintercept&0xffff0000)-((64-snap.pwallpos)<<10);
                            else
-                              xintercept=(xintercept&0xffff0000)+((64-pwallpos)<<10);
-                           yintercept=yintercept-((ystep*pwallpos)>>6);
-                           ytile = (short) (yintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitVertWall();
+                              rc->xintercept=(rc->xintercept&0xffff0000)+((64-snap.pwallpos)<<10);
+                           rc->yintercept=rc->yintercept-((ystep*snap.pwallpos)>>6);
+                           rc->ytile = (short) (rc->yintercept >> TILESHIFT);
+                           rc->tilehit=snap.pwalltile;
+                           HitVertWall(rc);
                         }
                      }
                   }
                }
                else
                {
-                  yintercept=ytile<<TILESHIFT;
-                  xtile = (short) (xintercept >> TILESHIFT);
-                  HitHorizWall();
+                  rc->yintercept=rc->ytile<<TILESHIFT;
+                  rc->xtile = (short) (rc->xintercept >> TILESHIFT);
+                  HitHorizWall(rc);
                }
             }
             break;
          }
 passhoriz:
-         *((byte *)spotvis+yspot)=1;
-         ytile+=ytilestep;
-         xintercept+=xstep;
-         yspot=(word)((((uint32_t)xintercept>>16)<<mapshift)+ytile);
+         MarkVisTile(rc, rc->yspot);
+         rc->ytile+=rc->ytilestep;
+         rc->xintercept+=xstep;
+         rc->yspot=(word)((((uint32_t)rc->xintercept>>16)<<mapshift)+rc->ytile);
       }
       while(1);
    }
 }
 
+/*
+====================
+=
+= CastStrip
+=
+====================
+*/
+
+static void CastStrip(raycast_t *rc)
+{
+   int i;
+
+   /* forget what the strip saw last frame */
+   for(i = 0; i < rc->numvistiles; i++)
+      rc->seen[rc->vistiles[i]>>5] = 0;
+
+   rc->min_wallheight = viewheight;
+   rc->byteswritten   = 0;
+   rc->numvistiles    = 0;
+   rc->lastside       = -1;        /* the first pixel is on a new wall */
+   rc->lasttilehit    = -1;
+   AsmRefresh (rc);
+   ScalePost (rc);                 /* no more optimization on last post */
+}
+
+/*
+=============================================================================
+
+                              RAY CASTING THREADS
+
+Each thread casts its own strip of columns, so it only ever writes its
+own part of wallheight[] and vbuf.  The strips start on a multiple of
+four columns, which keeps the posts identical to a single threaded cast.
+
+=============================================================================
+*/
+
+#define MAXRAYTHREADS   16
+#define MINSTRIPWIDTH   64
+
+static raycast_t  raystrips[MAXRAYTHREADS];
+static LR_Thread *raythread[MAXRAYTHREADS];
+static int        raythreads = 1;
+static LR_Mutex  *raymutex;
+static LR_Cond   *raystart,*raydone;
+static unsigned   rayframe;
+static int        raypending;
+static boolean    rayquit;
+
+static void RayThread (void *data)
+{
+   raycast_t *rc  = (raycast_t *)data;
+   unsigned frame = 0;
+
+   LR_LockMutex(raymutex);
+
+   for(;;)
+   {
+      while(frame == rayframe && !rayquit)
+         LR_CondWait(raystart, raymutex);
+
+      if(rayquit)
+         break;
+
+      frame = rayframe;
+      LR_UnlockMutex(raymutex);
+
+      if(rc->startx < rc->endx)
+         CastStrip(rc);
+
+      LR_LockMutex(raymutex);
+      if(--raypending == 0)
+         LR_CondSignal(raydone);
+   }
+
+   LR_UnlockMutex(raymutex);
+}
+
+/*
+====================
+=
+= InitRayThreads
+=
+= Starts param_threads-1 helper threads, or one per CPU if it isn't set
+=
+====================
+*/
+
+void InitRayThreads (void)
+{
+   int i;
+
+   raythreads = param_threads;
+   if(raythreads <= 0)
+      raythreads = LR_GetCPUCount();
+   if(raythreads > MAXRAYTHREADS)
+      raythreads = MAXRAYTHREADS;
+   if(raythreads == 1)
+      return;
+
+   raymutex = LR_CreateMutex();
+   raystart = LR_CreateCond();
+   raydone  = LR_CreateCond();
+
+   if(!raymutex || !raystart || !raydone)
+   {
+      ShutdownRayThreads();
+      return;
+   }
+
+   for(i = 1; i < raythreads; i++)
+   {
+      raythread[i] = LR_CreateThread(RayThread, &raystrips[i]);
+      if(!raythread[i])
+         break;
+   }
+
+   raythreads = i;
+   if(raythreads == 1)
+      ShutdownRayThreads();
+}
+
+/*
+====================
+=
+= ShutdownRayThreads
+=
+====================
+*/
+
+void ShutdownRayThreads (void)
+{
+   int i;
+
+   if(raymutex)
+   {
+      LR_LockMutex(raymutex);
+      rayquit = true;
+      LR_CondBroadcast(raystart);
+      LR_UnlockMutex(raymutex);
+   }
+
+   for(i = 1; i < MAXRAYTHREADS; i++)
+   {
+      LR_WaitThread(raythread[i]);
+      raythread[i] = NULL;
+   }
+
+   LR_DestroyCond(raydone);
+   LR_DestroyCond(raystart);
+   LR_DestroyMutex(raymutex);
+   raydone    = raystart = NULL;
+   raymutex   = NULL;
+   rayquit    = false;
+   raythreads = 1;
+}
+
+/*
+====================
+=
+= MergeVisTiles
+=
+= Marks the tiles a strip saw in spotvis and adds them to vistiles,
+= on the main thread once all strips are done.  Strips can both see a
+= tile, so a tile already marked is skipped.
+=
+====================
+*/
+
+static void MergeVisTiles(raycast_t *rc)
+{
+   int  i;
+   byte *spot;
+
+   for(i = 0; i < rc->numvistiles; i++)
+   {
+      spot = (byte *)spotvis + rc->vistiles[i];
+      if(!*spot)
+      {
+         *spot = 1;
+         vistiles[numvistiles++] = rc->vistiles[i];
+      }
+   }
+}
+
 /*
 ====================
 =
@@ -1475,20 +2527,66 @@ passhoriz:
 
 static void WallRefresh(void)
 {
+   int i, stripwidth;
+
    xpartialdown = viewx&(TILEGLOBAL-1);
    xpartialup = TILEGLOBAL-xpartialdown;
    ypartialdown = viewy&(TILEGLOBAL-1);
    ypartialup = TILEGLOBAL-ypartialdown;
 
+   stripwidth = ((viewwidth + raythreads - 1) / raythreads + 3) & ~3;
+   if(stripwidth < MINSTRIPWIDTH)
+      stripwidth = MINSTRIPWIDTH;
+
+   for(i = 0; i < raythreads; i++)
+   {
+      raystrips[i].startx = i * stripwidth;
+      raystrips[i].endx   = raystrips[i].startx + stripwidth;
+
+      if(raystrips[i].startx > viewwidth)
+         raystrips[i].startx = viewwidth;
+      if(raystrips[i].endx > viewwidth || i == raythreads - 1)
+         raystrips[i].endx = viewwidth;
+   }
+
+   if(raythreads > 1)
+   {
+      LR_LockMutex(raymutex);
+      raypending = raythreads - 1;
+      rayframe++;
+      LR_CondBroadcast(raystart);
+      LR_UnlockMutex(raymutex);
+   }
+
+   CastStrip(&raystrips[0]);
+
+   if(raythreads > 1)
+   {
+      /* DrawScaleds clips against wallheight[], so every strip must be done */
+      LR_LockMutex(raymutex);
+      while(raypending)
+         LR_CondWait(raydone, raymutex);
+      LR_UnlockMutex(raymutex);
+   }
+
    min_wallheight = viewheight;
-   lastside = -1;                  /* the first pixel is on a new wall */
-   AsmRefresh ();
-   ScalePost ();                   /* no more optimization on last post */
+   for(i = 0; i < raythreads; i++)
+   {
+      if(raystrips[i].startx < raystrips[i].endx)
+      {
+         if(raystrips[i].min_wallheight < min_wallheight)
+            min_wallheight = raystrips[i].min_wallheight;
+         viewbyteswritten += raystrips[i].byteswritten;
+         MergeVisTiles(&raystrips[i]);
+      }
+   }
+
+   BuildWallMin();
 }
 
 static void CalcViewVariables(void)
 {
-   viewangle = player->angle;
+   viewangle = snap.player.angle;
 
 #if 0
    printf("\nvieangle=%d\n",viewangle);
@@ -1502,14 +2600,14 @@ static void CalcViewVariables(void)
    printf("%d\n",viewcos);
 #endif
    
-   viewx     = player->x - FixedMul(focallength,viewcos);
-   viewy     = player->y + FixedMul(focallength,viewsin);
+   viewx     = snap.player.x - FixedMul(focallength,viewcos);
+   viewy     = snap.player.y + FixedMul(focallength,viewsin);
 
    focaltx   = (short)(viewx>>TILESHIFT);
    focalty   = (short)(viewy>>TILESHIFT);
 
-   viewtx    = (short)(player->x >> TILESHIFT);
-   viewty    = (short)(player->y >> TILESHIFT);
+   viewtx    = (short)(snap.player.x >> TILESHIFT);
+   viewty    = (short)(snap.player.y >> TILESHIFT);
 }
 
 //==========================================================================
@@ -1517,39 +2615,595 @@ static void CalcViewVariables(void)
 /*
 ========================
 =
-= ThreeDRefresh
+= TransposeView
+=
+= Copies the column major viewbuffer into the view on screen, in blocks
+= of 8x8 pixels so both sides stay in the cache
 =
 ========================
 */
 
-void ThreeDRefresh (void)
+static void TransposeView (byte *dest, unsigned pitch)
 {
-   /* clear out the traced array */
-   memset(spotvis,0,maparea);
+   int x, y, i, j;
+   int height = viewheight & ~7;
 
-   /* Detect all sprites over player fix */
-   spotvis[player->tilex][player->tiley] = 1;
+   for(x = 0; x < viewwidth; x += 8)
+   {
+      byte *src = viewbuffer + x * viewheight;
 
-   vbuf       = VL_LockSurface(screenBuffer);
-   vbuf      += screenofs;
-   vbufPitch  = bufferPitch;
+      for(y = 0; y < height; y += 8)
+      {
+         byte *out = dest + y * pitch + x;
+#ifdef __SSE2__
+         __m128i a0 = _mm_loadl_epi64((__m128i *) (src + 0 * viewheight + y));
+         __m128i a1 = _mm_loadl_epi64((__m128i *) (src + 1 * viewheight + y));
+         __m128i a2 = _mm_loadl_epi64((__m128i *) (src + 2 * viewheight + y));
+         __m128i a3 = _mm_loadl_epi64((__m128i *) (src + 3 * viewheight + y));
+         __m128i a4 = _mm_loadl_epi64((__m128i *) (src + 4 * viewheight + y));
+         __m128i a5 = _mm_loadl_epi64((__m128i *) (src + 5 * viewheight + y));
+         __m128i a6 = _mm_loadl_epi64((__m128i *) (src + 6 * viewheight + y));
+         __m128i a7 = _mm_loadl_epi64((__m128i *) (src + 7 * viewheight + y));
+         __m128i b0 = _mm_unpacklo_epi8(a0, a1);
+         __m128i b1 = _mm_unpacklo_epi8(a2, a3);
+         __m128i b2 = _mm_unpacklo_epi8(a4, a5);
+         __m128i b3 = _mm_unpacklo_epi8(a6, a7);
+         __m128i c0 = _mm_unpacklo_epi16(b0, b1);
+         __m128i c1 = _mm_unpackhi_epi16(b0, b1);
+         __m128i c2 = _mm_unpacklo_epi16(b2, b3);
+         __m128i c3 = _mm_unpackhi_epi16(b2, b3);
+         __m128i rows01 = _mm_unpacklo_epi32(c0, c2);
+         __m128i rows23 = _mm_unpackhi_epi32(c0, c2);
+         __m128i rows45 = _mm_unpacklo_epi32(c1, c3);
+         __m128i rows67 = _mm_unpackhi_epi32(c1, c3);
+
+         _mm_storel_epi64((__m128i *) (out + 0 * pitch), rows01);
+         _mm_storel_epi64((__m128i *) (out + 1 * pitch), _mm_unpackhi_epi64(rows01, rows01));
+         _mm_storel_epi64((__m128i *) (out + 2 * pitch), rows23);
+         _mm_storel_epi64((__m128i *) (out + 3 * pitch), _mm_unpackhi_epi64(rows23, rows23));
+         _mm_storel_epi64((__m128i *) (out + 4 * pitch), rows45);
+         _mm_storel_epi64((__m128i *) (out + 5 * pitch), _mm_unpackhi_epi64(rows45, rows45));
+         _mm_storel_epi64((__m128i *) (out + 6 * pitch), rows67);
+         _mm_storel_epi64((__m128i *) (out + 7 * pitch), _mm_unpackhi_epi64(rows67, rows67));
+#else
+         for(j = 0; j < 8; j++)
+            for(i = 0; i < 8; i++)
+               out[j * pitch + i] = src[i * viewheight + y + j];
+#endif
+      }
+
+      /* rows left over below the last full block */
+      for(j = height; j < viewheight; j++)
+         for(i = 0; i < 8; i++)
+            dest[j * pitch + x + i] = src[i * viewheight + j];
+   }
+}
+
+/*
+=============================================================================
+
+                               RENDER SNAPSHOT
+
+A frame is drawn from a snapshot of the parts of the game that change
+between tics: the player, the weapon, tilemap, the doors, the pushwall,
+the statics and the actors.  Drawing also feeds back into the game.  It
+activates the actors it sees, marks them FL_VISABLE and records their
+viewx for aiming, and lets the player pick up the bonus items they
+reached.  FinishSnapshot hands all of that back, for the first frame
+after each tic only.
+
+With --pipeline a render thread draws the snapshot of one tic into
+pipebuffer while PlayLoop goes on with the next one, and the following
+ThreeDRefresh puts the frame on the screen.  Frames reach the screen a
+tic later and the game learns what a frame saw a tic late, so demos are
+recorded without it.
+
+=============================================================================
+*/
+
+boolean pipelining;
+
+static byte      *pipebuffer;
+static LR_Thread *renderthread;
+static LR_Mutex  *rendermutex;
+static LR_Cond   *renderstart,*renderdone;
+static boolean    renderpending,renderquit;
+static boolean    renderinflight;
+
+/*
+====================
+=
+= TakeSnapshot
+=
+====================
+*/
+
+static void TakeSnapshot (void)
+{
+   int      i;
+   unsigned spot;
+   objtype  *obj;
+
+   snap.player      = *player;
+   snap.weapon      = gamestate.weapon;
+   snap.weaponframe = gamestate.weaponframe;
+   snap.victoryflag = gamestate.victoryflag;
+
+   memcpy(snap.tilemap, tilemap, sizeof(snap.tilemap));
+   memcpy(snap.doorposition, doorposition, sizeof(snap.doorposition));
+   snap.pwallpos  = pwallpos;
+   snap.pwallx    = pwallx;
+   snap.pwally    = pwally;
+   snap.pwalldir  = pwalldir;
+   snap.pwalltile = pwalltile;
+
+   /* unlink the statics of the last snapshot, then bucket the new ones */
+   for (i = 0; i < snap.numstatics; i++)
+      snap.statichead[(snap.statics[i].tilex<<mapshift)+snap.statics[i].tiley] = 0;
+
+   snap.numstatics = (int) (laststatobj - statobjlist);
+   memcpy(snap.statics, statobjlist, snap.numstatics * sizeof(statobj_t));
+
+   for (i = snap.numstatics - 1; i >= 0; i--)
+   {
+      spot = (snap.statics[i].tilex<<mapshift)+snap.statics[i].tiley;
+      snap.staticnext[i]     = snap.statichead[spot];
+      snap.statichead[spot]  = i + 1;
+   }
+
+   snap.numactors = 0;
+   for (obj = player->next; obj; obj = obj->next)
+   {
+      snap.actors[snap.numactors]          = *obj;
+      snap.actorsource[snap.numactors]     = obj;
+      snap.actorgeneration[snap.numactors] = objgeneration[obj - objlist];
+      snap.actorseen[snap.numactors++]     = false;
+   }
+
+   snap.numgrabbed = 0;
+
+   /* the frames drawn in between tics leave the game alone */
+   snap.feedback = !interpolating || !ticdrawn;
+   ticdrawn      = true;
+
+   if (interpolating)
+      InterpolateSnapshot ();
 
    CalcViewVariables();
+}
+
+/*
+====================
+=
+= FinishSnapshot
+=
+= Applies what drawing the snapshot found to the game, unless it was
+= drawn in between tics
+=
+====================
+*/
+
+static void FinishSnapshot (void)
+{
+   int      i;
+   objtype  *obj,*source;
+   statobj_t *statptr;
+
+   if (!snap.feedback)
+      return;
+
+   for (i = 0; i < snap.numactors; i++)
+   {
+      obj    = &snap.actors[i];
+      source = snap.actorsource[i];
+
+      /* removed since, or the slot handed to a new actor? */
+      if (!source->state
+            || objgeneration[source - objlist] != snap.actorgeneration[i])
+         continue;
+
+      if (snap.actorseen[i])
+         source->active = ac_yes;
+
+      source->viewx      = obj->viewx;
+      source->viewheight = obj->viewheight;
+      source->transx     = obj->transx;
+      source->transy     = obj->transy;
+      source->flags      = (source->flags & ~FL_VISABLE) | (obj->flags & FL_VISABLE);
+   }
+
+   for (i = 0; i < snap.numgrabbed; i++)
+   {
+      statptr = &statobjlist[snap.grabbed[i]];
+      if (statptr->shapenum != -1)
+         GetBonus (statptr);
+   }
+}
+
+/*
+========================
+=
+= DrawView
+=
+= Draws the snapshot into dest
+=
+========================
+*/
+
+static void DrawView (byte *dest, unsigned pitch)
+{
+   int i;
+
+   /* clear out what was traced last frame */
+   for (i = 0; i < numvistiles; i++)
+      *((byte *)spotvis+vistiles[i]) = 0;
+
+   /* Detect all sprites over player fix */
+   spotvis[snap.player.tilex][snap.player.tiley] = 2;
+   vistiles[0]  = (snap.player.tilex<<mapshift)+snap.player.tiley;
+   numvistiles  = 1;
+
+   if(param_transposed)
+   {
+      if(!viewbuffer)
+      {
+         viewbuffer = (byte *) malloc(screenWidth * screenHeight);
+         CHECKMALLOCRESULT(viewbuffer);
+      }
+
+      vbuf            = viewbuffer;
+      vbufPitch       = 1;
+      vbufColumnPitch = viewheight;
+   }
+   else
+   {
+      vbuf            = dest;
+      vbufPitch       = pitch;
+      vbufColumnPitch = 1;
+   }
+
+   ceilingcolor     = vgaCeiling[gamestate.episode*10+mapon];
+   viewbyteswritten = 0;
 
    /* follow the walls from there to the right, drawing as we go */
-   VGAClearScreen ();
+   if(!param_transposed)
+   {
+      PROFILE_BEGIN(pz_clearscreen);
+      VGAClearScreen ();
+      PROFILE_END(pz_clearscreen);
+   }
 
+   PROFILE_BEGIN(pz_wallrefresh);
    WallRefresh ();
+   PROFILE_END(pz_wallrefresh);
 
    /* draw all the scaled images */
-   DrawScaleds();          /* draw scaled stuff */
+   PROFILE_BEGIN(pz_drawscaleds);
+   if (param_spritebench)
+      BenchScaleds();
+   else
+      DrawScaleds();       /* draw scaled stuff */
+   PROFILE_END(pz_drawscaleds);
+
+   PROFILE_BEGIN(pz_drawweapon);
    DrawPlayerWeapon ();    /* draw player's hands */
+   PROFILE_END(pz_drawweapon);
 
-   if(Keyboard[sc_Tab] && viewsize == 21 && gamestate.weapon != -1)
-      ShowActStatus();
+   if(param_transposed)
+      TransposeView(dest, pitch);
 
-   VL_UnlockSurface(screenBuffer);
    vbuf = NULL;
+}
+
+/*
+========================
+=
+= RenderView
+=
+= Draws the 3D view into screenBuffer
+=
+========================
+*/
+
+static void RenderView (void)
+{
+   byte *dest;
+
+   TakeSnapshot ();
+
+   dest  = VL_LockSurface(screenBuffer);
+   dest += screenofs;
+
+   DrawView (dest, bufferPitch);
+
+   VL_UnlockSurface(screenBuffer);
+   VL_MarkDirty(viewscreenx, viewscreeny, viewwidth, viewheight);
+
+   FinishSnapshot ();
+}
+
+/*
+====================
+=
+= RenderThread
+=
+====================
+*/
+
+static void RenderThread (void *data)
+{
+   LR_LockMutex(rendermutex);
+
+   for(;;)
+   {
+      while(!renderpending && !renderquit)
+         LR_CondWait(renderstart, rendermutex);
+
+      if(renderquit)
+         break;
+
+      LR_UnlockMutex(rendermutex);
+
+      DrawView (pipebuffer, viewwidth);
+
+      LR_LockMutex(rendermutex);
+      renderpending = false;
+      LR_CondSignal(renderdone);
+   }
+
+   LR_UnlockMutex(rendermutex);
+}
+
+/*
+====================
+=
+= InitRenderThread
+=
+= Starts the render thread for --pipeline, or turns it off if it can't
+=
+====================
+*/
+
+void InitRenderThread (void)
+{
+   if(!param_pipeline)
+      return;
+
+   pipebuffer  = (byte *) malloc(screenWidth * screenHeight);
+   CHECKMALLOCRESULT(pipebuffer);
+
+   rendermutex = LR_CreateMutex();
+   renderstart = LR_CreateCond();
+   renderdone  = LR_CreateCond();
+
+   if(rendermutex && renderstart && renderdone)
+      renderthread = LR_CreateThread(RenderThread, NULL);
+
+   if(!renderthread)
+   {
+      ShutdownRenderThread();
+      param_pipeline = false;
+   }
+}
+
+/*
+====================
+=
+= ShutdownRenderThread
+=
+====================
+*/
+
+void ShutdownRenderThread (void)
+{
+   if(renderthread)
+   {
+      LR_LockMutex(rendermutex);
+      renderquit = true;
+      LR_CondSignal(renderstart);
+      LR_UnlockMutex(rendermutex);
+
+      LR_WaitThread(renderthread);
+      renderthread = NULL;
+   }
+
+   LR_DestroyCond(renderdone);
+   LR_DestroyCond(renderstart);
+   LR_DestroyMutex(rendermutex);
+   renderdone  = renderstart = NULL;
+   rendermutex = NULL;
+
+   free(pipebuffer);
+   pipebuffer = NULL;
+}
+
+/*
+====================
+=
+= StartRender
+=
+====================
+*/
+
+static void StartRender (void)
+{
+   TakeSnapshot ();
+
+   LR_LockMutex(rendermutex);
+   renderpending = true;
+   LR_CondSignal(renderstart);
+   LR_UnlockMutex(rendermutex);
+
+   renderinflight = true;
+}
+
+/*
+====================
+=
+= FinishRender
+=
+= Waits for the frame the render thread is drawing, copies it into
+= screenBuffer and applies its snapshot.  Returns false if there was none.
+=
+====================
+*/
+
+boolean FinishRender (void)
+{
+   byte *dest;
+   int   y;
+
+   if(!renderinflight)
+      return false;
+
+   LR_LockMutex(rendermutex);
+   while(renderpending)
+      LR_CondWait(renderdone, rendermutex);
+   LR_UnlockMutex(rendermutex);
+
+   renderinflight = false;
+
+   dest  = VL_LockSurface(screenBuffer);
+   dest += screenofs;
+
+   for(y = 0; y < viewheight; y++)
+      memcpy(dest + y * bufferPitch, pipebuffer + y * viewwidth, viewwidth);
+
+   VL_UnlockSurface(screenBuffer);
+   VL_MarkDirty(viewscreenx, viewscreeny, viewwidth, viewheight);
+
+   FinishSnapshot ();
+   return true;
+}
+
+/*
+========================
+=
+= HeightBench
+=
+= Checks heighttable against the division for every distance, then
+= times both sweeping z across the map in small steps, the way
+= neighbouring columns see a wall
+=
+========================
+*/
+
+static void HeightBench (void)
+{
+   const int32_t count = 1 << 22;
+   volatile int32_t sink;
+   int32_t  i, sum;
+   fixed    z, step;
+   uint64_t start, time[2];
+
+   for(z = MINDIST; z < (2*MAPSIZE*TILEGLOBAL); z += 0x100)
+   {
+      if(HeightFromDist(z) != heightnumerator / (z >> 8))
+      {
+         printf("heightbench: table differs at z=%d!\n", z);
+         return;
+      }
+   }
+
+   step = (MAPSIZE*TILEGLOBAL - MINDIST) / (count / 16);
+
+   start = LR_GetPerformanceCounter();
+   for(i = 0, sum = 0, z = MINDIST; i < count; i++, z += step)
+   {
+      if(z >= MAPSIZE*TILEGLOBAL)
+         z -= MAPSIZE*TILEGLOBAL - MINDIST;
+      sum += heightnumerator / (z >> 8);
+   }
+   sink    = sum;
+   time[0] = LR_GetPerformanceCounter() - start;
+
+   start = LR_GetPerformanceCounter();
+   for(i = 0, sum = 0, z = MINDIST; i < count; i++, z += step)
+   {
+      if(z >= MAPSIZE*TILEGLOBAL)
+         z -= MAPSIZE*TILEGLOBAL - MINDIST;
+      sum += HeightFromDist(z);
+   }
+   sink    = sum;
+   time[1] = LR_GetPerformanceCounter() - start;
+
+   printf("heightbench: %d heights identical, divide %.2f ns, table %.2f ns per column\n",
+         (int) ((2*MAPSIZE*TILEGLOBAL - MINDIST) >> 8),
+         time[0] * 1000.0 / count, time[1] * 1000.0 / count);
+   (void) sink;
+}
+
+/*
+========================
+=
+= ViewBench
+=
+= Renders frames views turning once around the player with each buffer
+= layout and prints the time per frame, for --viewbench
+=
+========================
+*/
+
+void ViewBench (int frames)
+{
+   int      i, layout;
+   short    oldangle = player->angle;
+   boolean  oldtransposed = param_transposed;
+   uint64_t start, time[2], bytes[2] = { 0, 0 };
+
+   for(layout = 0; layout < 2; layout++)
+   {
+      param_transposed = layout;
+      start = LR_GetPerformanceCounter();
+
+      for(i = 0; i < frames; i++)
+      {
+         player->angle = (short) ((int32_t)i * ANGLES / frames);
+         RenderView();
+         bytes[layout] += viewbyteswritten;
+      }
+
+      time[layout] = LR_GetPerformanceCounter() - start;
+   }
+
+   printf("viewbench %dx%d (view %dx%d), %d frames: row major %u us/frame, transposed %u us/frame\n",
+         screenWidth, screenHeight, viewwidth, viewheight, frames,
+         (unsigned) (time[0] / frames), (unsigned) (time[1] / frames));
+   printf("viewbench %u byte view, ceiling/floor/walls wrote: row major %u bytes/frame, transposed %u bytes/frame\n",
+         (unsigned) (viewwidth * viewheight),
+         (unsigned) (bytes[0] / frames), (unsigned) (bytes[1] / frames));
+
+   player->angle    = oldangle;
+   param_transposed = oldtransposed;
+
+   HeightBench ();
+}
+
+
+/*
+========================
+=
+= ThreeDRefresh
+=
+========================
+*/
+
+void ThreeDRefresh (void)
+{
+   if (pipelining)
+   {
+      /* start the next frame before showing the last one */
+      boolean drawn = FinishRender ();
+
+      StartRender ();
+      if (!drawn)
+         return;
+   }
+   else
+      RenderView ();
+
+   if(Keyboard[sc_Tab] && viewsize == 21 && gamestate.weapon != -1)
+      ShowActStatus();
 
    /* show screen and time last cycle */
    if (fizzlein)
@@ -1560,5 +3214,9 @@ void ThreeDRefresh (void)
       lasttimecount = GetTimeCount();          // don't make a big tic count
    }
    else
+   {
+      PROFILE_BEGIN(pz_updatescreen);
       VH_UpdateScreen();
+      PROFILE_END(pz_updatescreen);
+   }
 }
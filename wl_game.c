@@ -25,6 +25,8 @@ boolean         ingame,fizzlein;
 gametype        gamestate;
 byte            bordercol=VIEWCOLOR;        // color of the Change View/Ingame border
 
+static byte     demoseed;                   // rndindex a demo starts its level with
+
 #ifdef SPEAR
 int32_t         spearx,speary;
 unsigned        spearangle;
@@ -601,7 +603,10 @@ void SetupGameLevel (void)
    }
 
    if (demoplayback || demorecord)
+   {
       US_InitRndT (false);
+      rndindex = demoseed;
+   }
    else
       US_InitRndT (true);
 
@@ -702,6 +707,9 @@ void SetupGameLevel (void)
       }
    }
 
+   if (param_spritebench)
+      SpawnBenchStatics (param_spritebench);
+
    /* have the caching manager load and purge stuff 
     * to make sure all marks are in memory. */
    CA_LoadAllSounds ();
@@ -920,6 +928,56 @@ void ShowActStatus(void)
 
 //==========================================================================
 
+/*
+=============================================================================
+
+                               DEMO RECORDING
+
+A recorded demo streams the input of every frame to disk as it is played,
+so there is no limit on its length.  The file starts with a small header:
+
+   0  "WLDM"
+   4  version (DEMOVERSION)
+   5  episode
+   6  map
+   7  difficulty
+   8  random seed
+   9  tics per frame (DEMOTICS)
+  10  two reserved bytes
+  12  number of frames, little endian (0 if the recording was cut short)
+
+followed by runs of identical frames, each a count (1-255) and the three
+bytes PollControls reads per frame: button bits, controlx and controly.
+A zero count ends the demo.  Holding a key or standing still are the
+common cases, so most runs cover many frames.
+
+=============================================================================
+*/
+
+#define DEMOVERSION     1
+#define DEMOHEADERSIZE  16
+
+char    demoname[13] = "DEMO?.";
+
+static FILE     *demofile;
+static byte      demorun[4];         /* count, buttonbits, controlx, controly */
+static uint32_t  demoframecount;
+
+/*
+==================
+=
+= WriteDemoRun
+=
+==================
+*/
+
+static void WriteDemoRun (void)
+{
+   if (demorun[0] && fwrite (demorun, sizeof(demorun), 1, demofile) != 1)
+      Quit ("Error writing demo!");
+   demorun[0] = 0;
+}
+
 /*
 ==================
 =
@@ -928,13 +986,227 @@ void ShowActStatus(void)
 ==================
 */
 
-char    demoname[13] = "DEMO?.";
+static void StartDemoRecord (const char *filename)
+{
+   byte header[DEMOHEADERSIZE];
+
+   demofile = fopen (filename, "wb");
+   if (!demofile)
+      Quit ("Unable to write demo %s!", filename);
+
+   memset (header, 0, sizeof(header));
+   memcpy (header, "WLDM", 4);
+   header[4] = DEMOVERSION;
+   header[5] = gamestate.episode;
+   header[6] = gamestate.mapon;
+   header[7] = gamestate.difficulty;
+   header[8] = demoseed = (LR_GetTicks() >> 4) & 0xff;
+   header[9] = DEMOTICS;
+
+   if (fwrite (header, sizeof(header), 1, demofile) != 1)
+      Quit ("Error writing demo!");
+
+   demorun[0] = 0;
+   demoframecount = 0;
+   demorecord = true;
+}
+
+/*
+==================
+=
+= RecordDemoFrame
+=
+= Called by PollControls with the input of every recorded frame
+=
+==================
+*/
+
+void RecordDemoFrame (byte buttonbits, int8_t x, int8_t y)
+{
+   if (demorun[0] && demorun[0] < 255
+         && demorun[1] == buttonbits && demorun[2] == (byte) x && demorun[3] == (byte) y)
+      demorun[0]++;
+   else
+   {
+      WriteDemoRun ();
+      demorun[0] = 1;
+      demorun[1] = buttonbits;
+      demorun[2] = (byte) x;
+      demorun[3] = (byte) y;
+   }
+
+   demoframecount++;
+}
+
+/*
+==================
+=
+= FinishDemoRecord
+=
+==================
+*/
+
+void FinishDemoRecord (void)
+{
+   byte trailer[4];
+   long length;
+
+   demorecord = false;
+   if (!demofile)
+      return;
 
-void FinishDemoRecord (void) {return;}
-void RecordDemo (void) {return;}
+   WriteDemoRun ();
+   fputc (0, demofile);
+   length = ftell (demofile);
+
+   trailer[0] = (byte) demoframecount;
+   trailer[1] = (byte) (demoframecount >> 8);
+   trailer[2] = (byte) (demoframecount >> 16);
+   trailer[3] = (byte) (demoframecount >> 24);
+   fseek (demofile, 12, SEEK_SET);
+   fwrite (trailer, sizeof(trailer), 1, demofile);
+
+   if (fclose (demofile))
+      Quit ("Error writing demo!");
+   demofile = NULL;
+
+   printf ("Recorded %u frames (%u bytes uncompressed) into %ld bytes\n",
+         demoframecount, demoframecount * 3, length);
+}
+
+/*
+==================
+=
+= RecordDemoFile
+=
+= Records a demo of the given level (numbered like --tedlevel) to filename
+=
+==================
+*/
+
+void RecordDemoFile (const char *filename, int level, int difficulty)
+{
+   VW_FadeOut ();
+
+#ifndef SPEAR
+   NewGame (difficulty,level/10);
+   gamestate.mapon = level%10;
+#else
+   NewGame (difficulty,0);
+   gamestate.mapon = level;
+#endif
+
+   StartDemoRecord (filename);
+
+   SETFONTCOLOR(0,15);
+   DrawPlayScreen ();
+   VW_FadeIn ();
+
+   startgame = false;
+
+   SetupGameLevel ();
+   StartMusic ();
+
+   fizzlein = true;
+
+   PlayLoop ();
+
+   StopMusic ();
+   VW_FadeOut ();
+
+   FinishDemoRecord ();
+}
+
+/*
+==================
+=
+= RecordDemo
+=
+= Asks for a level and a demo number and records demo<number>.rec into
+= the config directory
+=
+==================
+*/
+
+void RecordDemo (void)
+{
+   int  level,esc,maps,number;
+   char demopath[300];
+
+   CenterWindow(26,3);
+   PrintY+=6;
+   CA_CacheGrChunk(STARTFONT);
+   fontnumber=0;
+   SETFONTCOLOR(0,15);
+#ifndef SPEAR
+   US_Print("  Demo which level(1-60): "); maps = 60;
+#else
+   US_Print("  Demo which level(1-21): "); maps = 21;
+#endif
+   VW_UpdateScreen();
+   VW_FadeIn ();
+   esc = !US_LineInput (px,py,str,NULL,true,2,0);
+   if (esc)
+      return;
+
+   level = atoi (str) - 1;
+   if (level >= maps || level < 0)
+      return;
+
+   CenterWindow(24,3);
+   PrintY+=6;
+   US_Print(" Demo number (0-9): ");
+   VW_UpdateScreen();
+   esc = !US_LineInput (px,py,str,NULL,true,1,0);
+   if (esc)
+      return;
+
+   number = atoi (str);
+   if (number < 0 || number > 9)
+      return;
+
+   if(configdir[0])
+      snprintf(demopath, sizeof(demopath), "%s/demo%d.rec", configdir, number);
+   else
+      snprintf(demopath, sizeof(demopath), "demo%d.rec", number);
+
+   RecordDemoFile (demopath, level, gd_hard);
+}
 
 //==========================================================================
 
+/*
+==================
+=
+= RunDemo
+=
+= Plays the demo set up in demoptr..lastdemoptr
+=
+==================
+*/
+
+static void RunDemo (void)
+{
+   if (param_timedemo == -1)
+      VW_FadeOut ();
+
+   SETFONTCOLOR(0,15);
+   DrawPlayScreen ();
+
+   startgame = false;
+   demoplayback = true;
+
+   SetupGameLevel ();
+   StartMusic ();
+
+   PlayLoop ();
+
+   demoplayback = false;
+
+   StopMusic ();
+   SD_StopDigitized ();
+}
+
 /*
 ==================
 =
@@ -973,30 +1245,222 @@ void PlayDemo (int demonumber)
     * But T_DEM00 and T_DEM01 of Wolf have a 0xd8 as third length size... */
    demoptr++;
    lastdemoptr = demoptr-4+length;
+   demoseed = 0;
 
-   VW_FadeOut ();
-
-   SETFONTCOLOR(0,15);
-   DrawPlayScreen ();
-
-   startgame = false;
-   demoplayback = true;
-
-   SetupGameLevel ();
-   StartMusic ();
-
-   PlayLoop ();
+   RunDemo ();
 
 #ifdef DEMOSEXTERN
    UNCACHEGRCHUNK(dems[demonumber]);
 #else
    MM_FreePtr (&demobuffer);
 #endif
+}
 
-   demoplayback = false;
+/*
+==================
+=
+= PlayDemoFile
+=
+= Plays a demo recorded by RecordDemoFile.  The runs are expanded into
+= the three bytes per frame PollControls reads from the stock demos.
+=
+==================
+*/
 
-   StopMusic ();
-   SD_StopDigitized ();
+void PlayDemoFile (const char *filename)
+{
+   FILE    *file;
+   byte    *data, *run, *end;
+   int8_t  *frames;
+   long     size;
+   uint32_t count;
+
+   file = fopen (filename, "rb");
+   if (!file)
+      Quit ("Can't open demo %s!", filename);
+
+   fseek (file, 0, SEEK_END);
+   size = ftell (file);
+   fseek (file, 0, SEEK_SET);
+
+   data = (byte *) malloc (size > 0 ? size : 1);
+   CHECKMALLOCRESULT(data);
+   if (size < DEMOHEADERSIZE || fread (data, size, 1, file) != 1)
+      size = 0;
+   fclose (file);
+
+   if (!size || memcmp (data, "WLDM", 4))
+      Quit ("%s is not a recorded demo!", filename);
+   if (data[4] != DEMOVERSION)
+      Quit ("Demo %s has version %d, expected %d!", filename, data[4], DEMOVERSION);
+   if (data[9] != DEMOTICS)
+      Quit ("Demo %s was recorded at %d tics per frame, expected %d!", filename, data[9], DEMOTICS);
+
+   /* the level and difficulty index game tables, so keep them in range */
+#ifndef SPEAR
+   if (data[5] >= 6 || data[6] >= 10 || data[7] > gd_hard)
+#else
+   if (data[5] != 0 || data[6] >= 21 || data[7] > gd_hard)
+#endif
+      Quit ("Demo %s starts on episode %d, map %d at difficulty %d, which this game does not have!",
+            filename, data[5] + 1, data[6] + 1, data[7]);
+
+   /* count the frames, a demo cut short has no frame count or end mark */
+   count = 0;
+   end   = data + size;
+   for (run = data + DEMOHEADERSIZE; run + 4 <= end && run[0]; run += 4)
+      count += run[0];
+
+   if (!count)
+      Quit ("Demo %s has no frames!", filename);
+
+   frames = (int8_t *) malloc (count * 3);
+   CHECKMALLOCRESULT(frames);
+
+   demoptr = frames;
+   for (run = data + DEMOHEADERSIZE; run + 4 <= end && run[0]; run += 4)
+   {
+      int i;
+
+      for (i = 0; i < run[0]; i++)
+      {
+         *demoptr++ = run[1];
+         *demoptr++ = run[2];
+         *demoptr++ = run[3];
+      }
+   }
+   lastdemoptr = demoptr;
+   demoptr = frames;
+
+   NewGame (data[7],data[5]);
+   gamestate.mapon = data[6];
+   demoseed = data[8];
+   free (data);
+
+   RunDemo ();
+
+   free (frames);
+}
+
+/*
+==================
+=
+= TimeDemoFrame
+=
+= Called by PlayLoop at the start of every frame while a demo is timed
+=
+==================
+*/
+
+static uint32_t *demoframetime;     /* microseconds per frame */
+static int       demoframes, maxdemoframes;
+static uint64_t  demoframestart;
+
+void TimeDemoFrame (void)
+{
+   uint64_t now = LR_GetPerformanceCounter();
+
+   if (demoframestart)
+   {
+      if (demoframes == maxdemoframes)
+      {
+         maxdemoframes = maxdemoframes ? maxdemoframes * 2 : 1024;
+         demoframetime = (uint32_t *) realloc(demoframetime, maxdemoframes * sizeof(*demoframetime));
+         CHECKMALLOCRESULT(demoframetime);
+      }
+      demoframetime[demoframes++] = (uint32_t) (now - demoframestart);
+   }
+
+   demoframestart = now;
+}
+
+static int CompareFrameTimes (const void *a, const void *b)
+{
+   uint32_t x = *(const uint32_t *) a;
+   uint32_t y = *(const uint32_t *) b;
+
+   return x < y ? -1 : x > y;
+}
+
+/*
+==================
+=
+= TimeDemo
+=
+= Plays a demo as fast as possible and prints the frame time stats, for
+= --timedemo.  Playback advances a fixed DEMOTICS per frame, so every
+= run simulates and draws the same frames and only the times change.
+= state is a checksum of where the demo ended up, it differs only if
+= a build plays the demo differently.
+=
+==================
+*/
+
+void TimeDemo (int demonumber)
+{
+   int      i;
+   uint64_t total = 0;
+   uint32_t p99, state;
+   int32_t  statevars[11];
+   double   fps;
+   char     demo[64];
+
+   demoframes     = 0;
+   demoframestart = 0;
+
+   if (param_demofile)
+   {
+      snprintf(demo, sizeof(demo), "%s", param_demofile);
+      PlayDemoFile (param_demofile);
+   }
+   else
+   {
+      snprintf(demo, sizeof(demo), "%d", demonumber);
+      PlayDemo (demonumber);
+   }
+   TimeDemoFrame ();
+
+   if (!demoframes)
+      Quit ("TimeDemo: Demo %s has no frames!", demo);
+
+   for (i = 0; i < demoframes; i++)
+      total += demoframetime[i];
+
+   qsort(demoframetime, demoframes, sizeof(*demoframetime), CompareFrameTimes);
+   p99 = demoframetime[(demoframes * 99 + 99) / 100 - 1];
+   fps = total ? demoframes * 1000000.0 / total : 0;
+
+   statevars[0]  = gamestate.mapon;
+   statevars[1]  = gamestate.score;
+   statevars[2]  = gamestate.health;
+   statevars[3]  = gamestate.ammo;
+   statevars[4]  = gamestate.killcount;
+   statevars[5]  = gamestate.secretcount;
+   statevars[6]  = gamestate.treasurecount;
+   statevars[7]  = gamestate.TimeCount;
+   statevars[8]  = player->x;
+   statevars[9]  = player->y;
+   statevars[10] = player->angle;
+
+   state = 2166136261u;            /* FNV-1a */
+   for (i = 0; i < (int) (sizeof(statevars) / sizeof(statevars[0])); i++)
+      state = (state ^ (uint32_t) statevars[i]) * 16777619u;
+
+   printf("timedemo %s at %ux%u (view %dx%d): %d frames in %.3f s, %.1f fps\n",
+         demo, screenWidth, screenHeight, viewwidth, viewheight,
+         demoframes, total / 1000000.0, fps);
+   printf("timedemo frame time: avg %.3f ms, min %.3f ms, max %.3f ms, p99 %.3f ms\n",
+         total / 1000.0 / demoframes, demoframetime[0] / 1000.0,
+         demoframetime[demoframes - 1] / 1000.0, p99 / 1000.0);
+   printf("TIMEDEMO demo=%s width=%u height=%u viewwidth=%d viewheight=%d frames=%d total_us=%llu"
+         " avg_us=%u min_us=%u max_us=%u p99_us=%u fps=%.2f state=%08x\n",
+         demo, screenWidth, screenHeight, viewwidth, viewheight, demoframes,
+         (unsigned long long) total, (unsigned) (total / demoframes), demoframetime[0],
+         demoframetime[demoframes - 1], p99, fps, state);
+
+   free(demoframetime);
+   demoframetime = NULL;
+   maxdemoframes = 0;
 }
 
 /*
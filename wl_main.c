@@ -96,6 +96,22 @@ int     param_joystickhat = -1;
 int     param_mission = 0;
 boolean param_goodtimes = false;
 boolean param_ignorenumchunks = false;
+int     param_threads = 0;              // default is one per CPU
+int     param_spritebench = 0;
+boolean param_transposed = false;
+int     param_viewbench = 0;
+int     param_timedemo = -1;            // default is not to time a demo
+char   *param_demofile = NULL;
+boolean param_interpolate = false;
+boolean param_pipeline = false;
+char   *param_record = NULL;
+int     param_wallmips = WALLMIPS_OFF;
+boolean param_nommap = false;
+int     param_huffbench = 0;
+boolean param_startuptrace = false;
+#ifdef ZONEPROFILER
+char   *param_profile = NULL;
+#endif
 
 /*
 =============================================================================
@@ -617,6 +633,13 @@ boolean LoadTheGame(FILE *file,int x,int y)
 
 void ShutdownId (void)
 {
+#ifdef ZONEPROFILER
+    ShutdownProfile ();
+#endif
+    ShutdownRenderThread ();
+    ShutdownRayThreads ();
+    ShutdownSpriteCache ();
+    ShutdownWallMips ();
     US_Shutdown ();
     SD_Shutdown ();
     PM_Shutdown ();
@@ -713,6 +736,9 @@ void CalcProjection (int32_t focal)
         pixelangle[halfview-1-i] = intang;
         pixelangle[halfview+i]   = -intang;
     }
+
+    SetupHeightTable ();
+    SetupScaling ();
 }
 
 
@@ -953,6 +979,7 @@ void InitDigiMap (void)
         DigiChannel[map[1]] = map[2];
         SD_PrepareSound(map[1]);
     }
+    SD_PrefetchSounds();
 }
 
 #ifndef SPEAR
@@ -1111,6 +1138,332 @@ void DoJukebox(void)
 }
 #endif
 
+/*
+==========================
+=
+= TraceStartup
+=
+= With --startup-trace prints how long the startup step that just
+= finished took, or starts the clock if step is NULL
+=
+==========================
+*/
+
+static uint64_t startupbegin, startuptime;
+
+static void TraceStartup (const char *step)
+{
+   uint64_t now;
+
+   if (!param_startuptrace)
+      return;
+
+   now = LR_GetPerformanceCounter();
+   if (step)
+      printf("startup: %-18s %8.2f ms\n", step, (now - startuptime) / 1000.0);
+   else
+      startupbegin = now;
+   startuptime = now;
+}
+
+/*
+==========================
+=
+= TraceFirstMenu
+=
+= With --startup-trace prints how long it took from the start until the
+= first menu waits for input
+=
+==========================
+*/
+
+void TraceFirstMenu (void)
+{
+   static boolean traced;
+
+   if (!param_startuptrace || traced)
+      return;
+
+   traced = true;
+   printf("startup: %-18s %8.2f ms\n", "first menu",
+         (LR_GetPerformanceCounter() - startupbegin) / 1000.0);
+}
+
+/*
+=============================================================================
+
+                               STARTUP TASKS
+
+The startup steps that load and convert the data files run as a small
+task graph.  Every task names the tasks it has to wait for.  The ones
+that touch the screen, input or the audio device run on the main thread,
+the others on up to MAXSTARTUPWORKERS worker threads (--threads minus
+one, like the ray casting helpers), while the main thread keeps pumping
+events so the signon screen stays responsive.  Without threads the tasks
+run on the main thread in table order, which satisfies the dependencies.
+
+=============================================================================
+*/
+
+#define MAXSTARTUPWORKERS   3
+
+enum
+{
+   ST_PM,
+   ST_CA,
+   ST_SD,
+   ST_DIGIMAP,
+   ST_CONFIG,
+   ST_INTRO,
+   ST_LATCHES,
+   ST_TABLES,
+   ST_WALLS,
+   ST_REDSHIFTS,
+   ST_ASSETCACHE,
+   NUMSTARTUPTASKS
+};
+
+#define ST(task)        (1u << (task))
+#define ALLSTARTUPTASKS (ST(NUMSTARTUPTASKS) - 1)
+
+typedef struct
+{
+   const char *name;
+   void      (*run) (void);
+   boolean     mainthread;          /* touches the screen, input or audio device */
+   unsigned    needs;               /* ST() mask of the tasks to wait for */
+} startuptask_t;
+
+static boolean wantjukebox;
+
+static void StartCache (void)
+{
+   CA_Startup ();
+   US_Startup ();
+}
+
+static void StartSound (void)
+{
+   if(param_timedemo == -1)
+      SD_Startup ();        /* --timedemo runs without audio */
+}
+
+static void StartIntro (void)
+{
+   /* HOLDING DOWN 'M' KEY? */
+#ifndef SPEARDEMO
+   if (Keyboard[sc_M])
+      wantjukebox = true;
+   else
+#endif
+      /* draw intro screen stuff */
+      IntroScreen ();
+}
+
+static void StartLatches (void)
+{
+   /* load in and lock down some basic chunks */
+   CA_CacheGrChunk(STARTFONT);
+   CA_CacheGrChunk(STATUSBARPIC);
+
+   LoadLatchMem ();
+}
+
+static void StartWalls (void)
+{
+   SetupWalls ();
+   SetupWallMips ();
+}
+
+static const startuptask_t startuptasks[NUMSTARTUPTASKS] =
+{
+   {"PM_Startup",         PM_Startup,         false, 0},
+   {"CA_Startup",         StartCache,         false, 0},
+   {"SD_Startup",         StartSound,         true,  ST(ST_PM)},
+   {"InitDigiMap",        InitDigiMap,        false, ST(ST_PM) | ST(ST_CA) | ST(ST_SD)},
+   {"ReadConfig",         ReadConfig,         true,  ST(ST_SD)},
+   {"IntroScreen",        StartIntro,         true,  ST(ST_CONFIG)},
+   {"LoadLatchMem",       StartLatches,       false, ST(ST_CA)},
+   {"BuildTables",        BuildTables,        false, 0},
+   {"SetupWalls",         StartWalls,         false, ST(ST_PM)},
+   {"InitRedShifts",      InitRedShifts,      false, 0},
+   {"CA_WriteAssetCache", CA_WriteAssetCache, false, ST(ST_CA) | ST(ST_DIGIMAP) | ST(ST_LATCHES)}
+};
+
+static LR_Mutex *startupmutex;
+static LR_Cond  *startupcond;
+static unsigned  startupstarted, startupdone;
+static unsigned  workertasks;       /* ST() mask of the tasks left to the workers */
+static uint64_t  taskstart[NUMSTARTUPTASKS], taskend[NUMSTARTUPTASKS];
+static int       taskthread[NUMSTARTUPTASKS];
+
+/*
+==========================
+=
+= NextStartupTask
+=
+= Returns a task from mask whose dependencies are done, or -1
+=
+==========================
+*/
+
+static int NextStartupTask (unsigned mask)
+{
+   int task;
+
+   for (task = 0; task < NUMSTARTUPTASKS; task++)
+   {
+      if ((mask & ST(task)) && !(startupstarted & ST(task))
+            && (startuptasks[task].needs & startupdone) == startuptasks[task].needs)
+         return task;
+   }
+   return -1;
+}
+
+/*
+==========================
+=
+= RunStartupTask
+=
+= Called and returns with startupmutex held, if there is one
+=
+==========================
+*/
+
+static void RunStartupTask (int task, int thread)
+{
+   startupstarted |= ST(task);
+   if (startupmutex)
+      LR_UnlockMutex (startupmutex);
+
+   taskthread[task] = thread;
+   taskstart[task]  = LR_GetPerformanceCounter();
+   startuptasks[task].run ();
+   taskend[task]    = LR_GetPerformanceCounter();
+
+   if (startupmutex)
+      LR_LockMutex (startupmutex);
+   startupdone |= ST(task);
+   if (startupcond)
+      LR_CondBroadcast (startupcond);
+}
+
+static void StartupWorker (void *data)
+{
+   int task;
+
+   LR_LockMutex (startupmutex);
+   while ((startupstarted & workertasks) != workertasks)
+   {
+      task = NextStartupTask (workertasks);
+      if (task >= 0)
+         RunStartupTask (task, (int) (intptr_t) data);
+      else
+         LR_CondWait (startupcond, startupmutex);
+   }
+   LR_UnlockMutex (startupmutex);
+}
+
+/*
+==========================
+=
+= RunStartupTasks
+=
+==========================
+*/
+
+static void RunStartupTasks (void)
+{
+   int i, task, workers, started;
+   unsigned maintasks;
+   LR_Thread *worker[MAXSTARTUPWORKERS];
+
+   workers = (param_threads ? param_threads : LR_GetCPUCount()) - 1;
+   if (workers > MAXSTARTUPWORKERS)
+      workers = MAXSTARTUPWORKERS;
+
+   workertasks = 0;
+   for (task = 0; task < NUMSTARTUPTASKS; task++)
+   {
+      if (!startuptasks[task].mainthread)
+         workertasks |= ST(task);
+   }
+
+   startupstarted = startupdone = 0;
+   started = 0;
+   if (workers > 0)
+   {
+      startupmutex = LR_CreateMutex();
+      startupcond  = LR_CreateCond();
+      if (startupmutex && startupcond)
+      {
+         LR_LockMutex (startupmutex);
+         for (i = 0; i < workers; i++)
+         {
+            worker[started] = LR_CreateThread(StartupWorker, (void *) (intptr_t) (i + 1));
+            if (worker[started])
+               started++;
+         }
+         if (!started)
+            LR_UnlockMutex (startupmutex);
+      }
+   }
+
+   if (!started)
+   {
+      /* everything on the main thread, in table order */
+      LR_DestroyCond (startupcond);
+      LR_DestroyMutex (startupmutex);
+      startupcond  = NULL;
+      startupmutex = NULL;
+      maintasks    = ALLSTARTUPTASKS;
+   }
+   else
+      maintasks = ALLSTARTUPTASKS & ~workertasks;
+
+   while (startupdone != ALLSTARTUPTASKS)
+   {
+      task = NextStartupTask (maintasks);
+      if (task >= 0)
+      {
+         RunStartupTask (task, 0);
+         continue;
+      }
+
+      /* waiting for the workers, keep the window alive meanwhile */
+      LR_UnlockMutex (startupmutex);
+      IN_ProcessEvents ();
+      LR_Delay (1);
+      LR_LockMutex (startupmutex);
+   }
+
+   if (started)
+   {
+      LR_UnlockMutex (startupmutex);
+      for (i = 0; i < started; i++)
+         LR_WaitThread (worker[i]);
+
+      LR_DestroyCond (startupcond);
+      LR_DestroyMutex (startupmutex);
+      startupcond  = NULL;
+      startupmutex = NULL;
+   }
+
+   if (param_startuptrace)
+   {
+      for (task = 0; task < NUMSTARTUPTASKS; task++)
+      {
+         printf("startup: %-18s %8.2f ms, from %7.2f ms on ", startuptasks[task].name,
+               (taskend[task] - taskstart[task]) / 1000.0, (taskstart[task] - startupbegin) / 1000.0);
+         if (taskthread[task])
+            printf("worker %d\n", taskthread[task]);
+         else
+            printf("main\n");
+      }
+   }
+   TraceStartup ("startup tasks");
+}
+
 /*
 ==========================
 =
@@ -1127,53 +1480,52 @@ static void InitGame(void)
    boolean didjukebox=false;
 #endif
 
+   TraceStartup (NULL);
+
    /* initialize SDL */
+   if(param_timedemo != -1)
+      LR_SetOffscreen();
    if(LR_Init(0) < 0)
       exit(1);
    atexit(LR_Quit);
 
    SignonScreen ();
+   TraceStartup ("SignonScreen");
 
    VH_Startup ();
    IN_Startup ();
-   PM_Startup ();
-   SD_Startup ();
-   CA_Startup ();
-   US_Startup ();
-
-   /* TODO: Will any memory checking be needed someday?? */
 
-   /* build some tables */
-   InitDigiMap ();
+   /* load and convert the data files, see STARTUP TASKS */
+   RunStartupTasks ();
 
-   ReadConfig ();
+   if(param_huffbench)
+   {
+      CA_HuffBench (param_huffbench);
+      Quit (NULL);
+   }
 
    SetupSaveGames();
 
    /* HOLDING DOWN 'M' KEY? */
 #ifndef SPEARDEMO
-   if (Keyboard[sc_M])
+   if (wantjukebox)
    {
       DoJukebox();
       didjukebox=true;
    }
-   else
 #endif
-      /* draw intro screen stuff */
-      IntroScreen ();
 
-   /* load in and lock down some basic chunks */
-   CA_CacheGrChunk(STARTFONT);
-   CA_CacheGrChunk(STATUSBARPIC);
-
-   LoadLatchMem ();
-   BuildTables ();          /* trig tables */
-   SetupWalls ();
+   InitRayThreads ();
+   InitRenderThread ();
+#ifdef ZONEPROFILER
+   InitProfile ();
+#endif
 
    NewViewSize (viewsize);
-
-   /* initialize variables */
-   InitRedShifts ();
+   TraceStartup ("NewViewSize");
+   if (param_startuptrace)
+      printf("startup: %-18s %8.2f ms, asset cache %s\n", "total",
+            (startuptime - startupbegin) / 1000.0, assetcachewarm ? "warm" : "cold");
 #ifndef SPEARDEMO
    if(!didjukebox)
 #endif
@@ -1292,7 +1644,8 @@ void Quit (const char *errorStr, ...)
         exit(1);
     }
 
-    if (!error || !*error)
+    /* --timedemo runs without audio, don't save that in the config */
+    if ((!error || !*error) && param_timedemo == -1)
         WriteConfig ();
 
     ShutdownId ();
@@ -1323,6 +1676,24 @@ static int DemoLoop(unsigned id)
    switch (id)
    {
       case JE_NONE:
+         if (param_timedemo != -1)
+         {
+            TimeDemo (param_timedemo);
+            Quit (NULL);
+         }
+
+         if (param_demofile)
+         {
+            PlayDemoFile (param_demofile);
+            Quit (NULL);
+         }
+
+         if (param_record)
+         {
+            RecordDemoFile (param_record, param_tedlevel, param_difficulty);
+            Quit (NULL);
+         }
+
          /* check for launch from ted */
          if (param_tedlevel != -1)
          {
@@ -1464,6 +1835,7 @@ void CheckParameters(int argc, char *argv[])
     bool hasError = false, showHelp = false;
     bool sampleRateGiven = false, audioBufferGiven = false;
     int defaultSampleRate = 44100;
+    unsigned renderWidth = 0, renderHeight = 0;
     unsigned i;
 
     screenBits = 16;
@@ -1519,6 +1891,22 @@ void CheckParameters(int argc, char *argv[])
                     printf("Screen size must be a multiple of 320x200 or 320x240!\n"), hasError = true;
             }
         }
+        else if(!strcmp(arg, ("--renderres")))
+        {
+            if(i + 2 >= argc)
+            {
+                printf("The renderres option needs the width and the height argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                renderWidth = atoi(argv[++i]);
+                renderHeight = atoi(argv[++i]);
+                unsigned factor = renderWidth / 320;
+                if(renderWidth % 320 || renderHeight != 200 * factor && renderHeight != 240 * factor)
+                    printf("Render size must be a multiple of 320x200 or 320x240!\n"), hasError = true;
+            }
+        }
         else if(!strcmp(arg, ("--joystick")))
         {
             if(++i >= argc)
@@ -1581,10 +1969,165 @@ void CheckParameters(int argc, char *argv[])
             param_goodtimes = true;
         else if(!strcmp(arg, ("--ignorenumchunks")))
             param_ignorenumchunks = true;
+        else if(!strcmp(arg, ("--threads")))
+        {
+            if(++i >= argc)
+            {
+                printf("The threads option is missing the count argument!\n");
+                hasError = true;
+            }
+            else param_threads = atoi(argv[i]);
+        }
+        else if(!strcmp(arg, ("--spritebench")))
+        {
+            if(++i >= argc)
+            {
+                printf("The spritebench option is missing the count argument!\n");
+                hasError = true;
+            }
+            else param_spritebench = atoi(argv[i]);
+        }
+        else if(!strcmp(arg, ("--transposed")))
+            param_transposed = true;
+        else if(!strcmp(arg, ("--viewbench")))
+        {
+            if(++i >= argc)
+            {
+                printf("The viewbench option is missing the frames argument!\n");
+                hasError = true;
+            }
+            else param_viewbench = atoi(argv[i]);
+        }
+        else if(!strcmp(arg, ("--timedemo")))
+        {
+            if(++i >= argc)
+            {
+                printf("The timedemo option is missing the demo argument!\n");
+                hasError = true;
+            }
+            else if(argv[i][0] < '0' || argv[i][0] > '9')
+            {
+                param_demofile = argv[i];
+                param_timedemo = 0;
+                param_nowait = true;
+            }
+            else
+            {
+                param_timedemo = atoi(argv[i]);
+#ifndef SPEARDEMO
+                if(param_timedemo < 0 || param_timedemo > 3)
+                {
+                    printf("The timedemo option must be between 0 and 3!\n");
+                    hasError = true;
+                }
+#else
+                if(param_timedemo != 0)
+                {
+                    printf("The timedemo option must be 0!\n");
+                    hasError = true;
+                }
+#endif
+                param_nowait = true;
+            }
+        }
+        else if(!strcmp(arg, ("--interpolate")))
+            param_interpolate = true;
+        else if(!strcmp(arg, ("--huffbench")))
+        {
+            if(++i >= argc)
+            {
+                printf("The huffbench option is missing the passes argument!\n");
+                hasError = true;
+            }
+            else param_huffbench = atoi(argv[i]);
+        }
+        else if(!strcmp(arg, ("--nommap")))
+            param_nommap = true;
+        else if(!strcmp(arg, ("--startup-trace")))
+            param_startuptrace = true;
+        else if(!strcmp(arg, ("--wallmips")))
+        {
+            if(++i >= argc)
+            {
+                printf("The wallmips option is missing the mode argument!\n");
+                hasError = true;
+            }
+            else if(!strcmp(argv[i], "filter"))
+                param_wallmips = WALLMIPS_FILTER;
+            else if(!strcmp(argv[i], "nearest"))
+                param_wallmips = WALLMIPS_NEAREST;
+            else if(!strcmp(argv[i], "off"))
+                param_wallmips = WALLMIPS_OFF;
+            else
+            {
+                printf("The wallmips mode must be filter, nearest or off!\n");
+                hasError = true;
+            }
+        }
+        else if(!strcmp(arg, ("--pipeline")))
+            param_pipeline = true;
+        else if(!strcmp(arg, ("--playdemo")))
+        {
+            if(++i >= argc)
+            {
+                printf("The playdemo option is missing the file argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_demofile = argv[i];
+                param_nowait = true;
+            }
+        }
+        else if(!strcmp(arg, ("--record")))
+        {
+            if(++i >= argc)
+            {
+                printf("The record option is missing the file argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_record = argv[i];
+                param_nowait = true;
+            }
+        }
+#ifdef ZONEPROFILER
+        else if(!strcmp(arg, ("--profile")))
+        {
+            if(++i >= argc)
+            {
+                printf("The profile option is missing the file argument!\n");
+                hasError = true;
+            }
+            else param_profile = argv[i];
+        }
+#endif
         else if(!strcmp(arg, ("--help")))
             showHelp = true;
         else hasError = true;
     }
+    if(param_record && param_tedlevel == -1)
+    {
+        printf("The record option needs the level given with --tedlevel!\n");
+        hasError = true;
+    }
+    if(renderWidth && !hasError)
+    {
+        // the screen has to be the same whole multiple of the render size on both axes
+        unsigned scale = screenWidth / renderWidth;
+        if(!scale || screenWidth != renderWidth * scale || screenHeight != renderHeight * scale)
+        {
+            printf("The screen resolution must be a whole multiple of the render size!\n");
+            hasError = true;
+        }
+        else
+        {
+            outputScale = scale;
+            screenWidth = renderWidth;
+            screenHeight = renderHeight;
+        }
+    }
     if(hasError || showHelp)
     {
         if(hasError) printf("\n");
@@ -1603,11 +2146,46 @@ void CheckParameters(int argc, char *argv[])
             " --windowed[-mouse]     Starts the game in a window [and grabs mouse]\n"
             " --res <width> <height> Sets the screen resolution\n"
             "                        (must be multiple of 320x200 or 320x240)\n"
+            " --renderres <w> <h>    Draws the game at this size and scales it\n"
+            "                        up to the --res resolution\n"
             " --joystick <index>     Use the index-th joystick if available\n"
             "                        (-1 to disable joystick, default: 0)\n"
             " --joystickhat <index>  Enables movement with the given coolie hat\n"
             " --ignorenumchunks      Ignores the number of chunks in VGAHEAD.*\n"
             "                        (may be useful for some broken mods)\n"
+            " --threads <count>      Number of threads used to cast the walls and to\n"
+            "                        load the data files\n"
+            "                        (default: one per CPU, 1 disables threading)\n"
+            " --spritebench <count>  Adds count statics around the player in every level\n"
+            "                        and prints how long the sprites take to sort and draw\n"
+            " --transposed           Draws the 3D view column by column into a separate\n"
+            "                        buffer and transposes it onto the screen\n"
+            " --viewbench <frames>   Renders the first level view with both buffer layouts,\n"
+            "                        prints the time per frame and quits\n"
+            " --timedemo <demo>      Plays the demo (0-3 or a recorded file) as fast as\n"
+            "                        possible without video or audio output, prints\n"
+            "                        frame time stats and quits\n"
+            " --interpolate          Draws frames in between the 70 Hz game tics, so the\n"
+            "                        view moves smoothly on faster displays\n"
+            " --pipeline             Draws each frame on a thread of its own while the\n"
+            "                        game goes on with the next tic\n"
+            " --huffbench <passes>   Expands the graphics chunks passes times with the old\n"
+            "                        and the table driven huffman decoder, prints the\n"
+            "                        throughput of each and quits\n"
+            " --nommap               Reads VSWAP into memory instead of mapping it\n"
+            " --startup-trace        Prints how long each startup step took, whether the\n"
+            "                        asset cache was warm or had to be rebuilt and when\n"
+            "                        the first menu came up\n"
+            " --wallmips <mode>      Draws distant walls from smaller copies of their\n"
+            "                        textures, averaged (filter) or picked (nearest)\n"
+            "                        so they keep the original look, default is off\n"
+            " --record <file>        Records a demo of the tedlevel level to file and quits\n"
+            " --playdemo <file>      Plays a recorded demo and quits\n"
+#ifdef ZONEPROFILER
+            " --profile <file>       Times the stages of every frame and writes the last\n"
+            "                        64K to file on exit or Tab+Z, as CSV if it ends in\n"
+            "                        .csv and as a Chrome trace otherwise\n"
+#endif
             " --configdir <dir>      Directory where config file and save games are stored\n"
 #if defined(_WIN32)
             "                        (default: current directory)\n"
@@ -331,6 +331,9 @@ US_ControlPanel (ScanCode scancode)
 {
     int which;
 
+    // a frame still being drawn must not see the game change under it
+    FinishRender ();
+
     if (ingame)
     {
         if (CP_CheckQuick (scancode))
@@ -392,6 +395,7 @@ US_ControlPanel (ScanCode scancode)
 
     DrawMainMenu ();
     MenuFadeIn ();
+    TraceFirstMenu ();
     StartGame = 0;
 
     //
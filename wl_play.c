@@ -30,6 +30,7 @@ static musicnames lastmusicchunk = (musicnames) 0;
 static int DebugOk;
 
 objtype objlist[MAXACTORS];
+word    objgeneration[MAXACTORS];   /* bumped each time a slot is reused */
 objtype *newobj, *obj, *player, *lastobj, *objfreelist, *killerobj;
 
 boolean noclip, ammocheat;
@@ -377,15 +378,18 @@ void PollControls (void)
    /* get timing info for last frame */
    if (demoplayback || demorecord)   /* demo recording and playback needs to be constant */
    {
-      /* wait up to DEMOTICS Wolf tics */
-      uint32_t curtime = LR_GetTicks();
-      lasttimecount += DEMOTICS;
-      int32_t timediff = (lasttimecount * 100) / 7 - curtime;
-      if(timediff > 0)
-         LR_Delay(timediff);
-
-      if(timediff < -2 * DEMOTICS)       /* more than 2-times DEMOTICS behind? */
-         lasttimecount = (curtime * 7) / 100;    /* yes, set to current timecount */
+      /* wait up to DEMOTICS Wolf tics, unless the demo is being timed */
+      if (param_timedemo == -1)
+      {
+         uint32_t curtime = LR_GetTicks();
+         lasttimecount += DEMOTICS;
+         int32_t timediff = (lasttimecount * 100) / 7 - curtime;
+         if(timediff > 0)
+            LR_Delay(timediff);
+
+         if(timediff < -2 * DEMOTICS)       /* more than 2-times DEMOTICS behind? */
+            lasttimecount = (curtime * 7) / 100;    /* yes, set to current timecount */
+      }
 
       tics = DEMOTICS;
    }
@@ -453,7 +457,7 @@ void PollControls (void)
 
    if (demorecord)
    {
-      /* save info out to demo buffer */
+      /* save info out to the demo file */
       controlx /= (int) tics;
       controly /= (int) tics;
 
@@ -467,17 +471,10 @@ void PollControls (void)
             buttonbits |= 1;
       }
 
-      *demoptr++ = buttonbits;
-      *demoptr++ = controlx;
-      *demoptr++ = controly;
+      RecordDemoFrame (buttonbits, (int8_t) controlx, (int8_t) controly);
 
-      if (demoptr >= lastdemoptr - 8)
-         playstate = EX_COMPLETED;
-      else
-      {
-         controlx *= (int) tics;
-         controly *= (int) tics;
-      }
+      controlx *= (int) tics;
+      controly *= (int) tics;
    }
 }
 
@@ -779,6 +776,7 @@ void GetNewActor (void)
     newobj = objfreelist;
     objfreelist = newobj->prev;
     memset (newobj, 0, sizeof (*newobj));
+    objgeneration[newobj - objlist]++;
 
     if (lastobj)
         lastobj->next = newobj;
@@ -947,6 +945,13 @@ void InitRedShifts (void)
          workptr++;
       }
    }
+
+   /* UpdatePaletteShifts switches between these every few tics */
+   VL_CachePalette (gamepal);
+   for (i = 0; i < NUMREDSHIFTS; i++)
+      VL_CachePalette (redshifts[i]);
+   for (i = 0; i < NUMWHITESHIFTS; i++)
+      VL_CachePalette (whiteshifts[i]);
 }
 
 
@@ -1204,22 +1209,61 @@ void PlayLoop (void)
    if (demoplayback)
       IN_StartAck ();
 
+   if (param_viewbench)
+   {
+      ViewBench (param_viewbench);
+      Quit (NULL);
+   }
+
+   interpolating = param_interpolate && !demoplayback && !demorecord;
+   pipelining    = param_pipeline && !demorecord;
+   if (interpolating)
+      SaveInterpolation ();
+
    do
    {
+      /* draw frames in between until the next tic is due */
+      while (interpolating && !TicElapsed ())
+      {
+         IN_ProcessEvents ();
+         ThreeDRefresh ();
+      }
+
+      PROFILE_BEGIN(pz_frame);
+
+      if (param_timedemo != -1)
+         TimeDemoFrame ();
+
+      if (interpolating)
+         SaveInterpolation ();
+
+      PROFILE_BEGIN(pz_pollcontrols);
       PollControls ();
+      PROFILE_END(pz_pollcontrols);
 
       /* actor thinking */
       madenoise = false;
 
+      PROFILE_BEGIN(pz_movedoors);
       MoveDoors ();
+      PROFILE_END(pz_movedoors);
+
+      PROFILE_BEGIN(pz_movepwalls);
       MovePWalls ();
+      PROFILE_END(pz_movepwalls);
 
+      PROFILE_BEGIN(pz_actors);
       for (obj = player; obj; obj = obj->next)
          DoActor (obj);
+      PROFILE_END(pz_actors);
 
+      PROFILE_BEGIN(pz_paletteshifts);
       UpdatePaletteShifts ();
+      PROFILE_END(pz_paletteshifts);
 
+      PROFILE_BEGIN(pz_threedrefresh);
       ThreeDRefresh ();
+      PROFILE_END(pz_threedrefresh);
 
       /* MAKE FUNNY FACE IF BJ DOESN'T MOVE FOR AWHILE */
 #ifdef SPEAR
@@ -1258,9 +1302,15 @@ void PlayLoop (void)
             playstate = EX_ABORT;
          }
       }
+
+      PROFILE_END(pz_frame);
    }
    while (!playstate && !startgame);
 
+   FinishRender ();
+   interpolating = false;
+   pipelining    = false;
+
    if (playstate != EX_DIED)
       FinishPaletteShifts ();
 }
@@ -0,0 +1,226 @@
+// WL_PROF.C
+
+#include <stdio.h>
+#include <string.h>
+#include "wl_def.h"
+
+#ifdef ZONEPROFILER
+
+/*
+=============================================================================
+
+                                ZONE PROFILER
+
+PROFILE_BEGIN/PROFILE_END pairs around the stages of a frame record how
+long each one took into a ring buffer, which WriteProfile dumps as CSV
+or as a Chrome trace (chrome://tracing or ui.perfetto.dev).  The ring
+keeps the last PROFILERINGSIZE zones.  Every zone claims its slot with
+an atomic increment, so recording never takes a lock.
+
+Nothing is recorded unless --profile is given.
+
+=============================================================================
+*/
+
+#define PROFILERINGSIZE 65536       /* power of two */
+
+typedef struct
+{
+   uint64_t start;                  /* microseconds */
+   uint32_t duration;
+   int32_t  frame;
+   int      zone;
+} profilezone_t;
+
+static profilezone_t     *profilering;
+static volatile uint32_t  profilecount;
+static volatile int32_t   profileframe;     /* PlayLoop iterations so far */
+
+static const char *zonenames[NUMPROFILEZONES] =
+{
+   "Frame",
+   "PollControls",
+   "MoveDoors",
+   "MovePWalls",
+   "DoActor",
+   "UpdatePaletteShifts",
+   "ThreeDRefresh",
+   "VGAClearScreen",
+   "WallRefresh",
+   "DrawScaleds",
+   "DrawPlayerWeapon",
+   "VH_UpdateScreen"
+};
+
+/*
+====================
+=
+= InitProfile
+=
+====================
+*/
+
+void InitProfile (void)
+{
+   if (!param_profile)
+      return;
+
+   profilering = (profilezone_t *) malloc(PROFILERINGSIZE * sizeof(*profilering));
+   CHECKMALLOCRESULT(profilering);
+   profilecount = 0;
+   profileframe = 0;
+}
+
+/*
+====================
+=
+= ShutdownProfile
+=
+====================
+*/
+
+void ShutdownProfile (void)
+{
+   WriteProfile ();
+
+   free(profilering);
+   profilering = NULL;
+}
+
+/*
+====================
+=
+= ProfileZone
+=
+= Records a zone that started at start and ends now.  The end of the
+= Frame zone starts the next frame.
+=
+====================
+*/
+
+void ProfileZone (int zone, uint64_t start)
+{
+   uint64_t end;
+   uint32_t slot;
+   profilezone_t *pz;
+
+   if (!profilering)
+      return;
+
+   end = LR_GetPerformanceCounter();
+
+#ifdef __GNUC__
+   slot = __sync_fetch_and_add(&profilecount, 1);
+#else
+   slot = profilecount++;
+#endif
+
+   pz           = &profilering[slot & (PROFILERINGSIZE - 1)];
+   pz->start    = start;
+   pz->duration = (uint32_t) (end - start);
+   pz->frame    = profileframe;
+   pz->zone     = zone;
+
+   if (zone == pz_frame)
+      profileframe++;
+}
+
+/*
+====================
+=
+= WriteProfile
+=
+= Writes the recorded zones to param_profile, as CSV if the name ends in
+= .csv and as a Chrome trace otherwise, and prints a summary per zone.
+= Returns false if there is nothing to write.
+=
+====================
+*/
+
+boolean WriteProfile (void)
+{
+   FILE     *file;
+   uint32_t  i, first, count;
+   size_t    len;
+   boolean   csv;
+   uint64_t  origin;
+   uint64_t  total[NUMPROFILEZONES];
+   uint32_t  calls[NUMPROFILEZONES], longest[NUMPROFILEZONES];
+   profilezone_t *pz;
+
+   if (!profilering || !profilecount)
+      return false;
+
+   count = profilecount;
+   first = 0;
+   if (count > PROFILERINGSIZE)
+   {
+      first = count - PROFILERINGSIZE;
+      count = PROFILERINGSIZE;
+   }
+
+   file = fopen(param_profile, "w");
+   if (!file)
+   {
+      printf("Unable to write profile %s!\n", param_profile);
+      return false;
+   }
+
+   len    = strlen(param_profile);
+   csv    = len >= 4 && !strcmp(param_profile + len - 4, ".csv");
+
+   /* zones are recorded as they end, so an outer zone kept in the ring
+      may have started before the oldest record */
+   origin = profilering[first & (PROFILERINGSIZE - 1)].start;
+   for (i = 1; i < count; i++)
+   {
+      pz = &profilering[(first + i) & (PROFILERINGSIZE - 1)];
+      if (pz->start < origin)
+         origin = pz->start;
+   }
+
+   memset(total, 0, sizeof(total));
+   memset(calls, 0, sizeof(calls));
+   memset(longest, 0, sizeof(longest));
+
+   if (csv)
+      fprintf(file, "frame,zone,start_us,duration_us\n");
+   else
+      fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+   for (i = 0; i < count; i++)
+   {
+      pz = &profilering[(first + i) & (PROFILERINGSIZE - 1)];
+
+      if (csv)
+         fprintf(file, "%d,%s,%llu,%u\n", pz->frame, zonenames[pz->zone],
+               (unsigned long long) (pz->start - origin), pz->duration);
+      else
+         fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+               "\"ts\":%llu,\"dur\":%u,\"args\":{\"frame\":%d}}",
+               i ? ",\n" : "", zonenames[pz->zone],
+               (unsigned long long) (pz->start - origin), pz->duration, pz->frame);
+
+      total[pz->zone] += pz->duration;
+      calls[pz->zone]++;
+      if (pz->duration > longest[pz->zone])
+         longest[pz->zone] = pz->duration;
+   }
+
+   if (!csv)
+      fprintf(file, "\n]}\n");
+   fclose(file);
+
+   printf("Wrote %u zones to %s\n", count, param_profile);
+   printf("%-20s %8s %10s %10s\n", "zone", "calls", "avg us", "max us");
+   for (i = 0; i < NUMPROFILEZONES; i++)
+   {
+      if (calls[i])
+         printf("%-20s %8u %10.1f %10u\n", zonenames[i], calls[i],
+               (double) total[i] / calls[i], longest[i]);
+   }
+
+   return true;
+}
+
+#endif